@@ -0,0 +1,86 @@
+// Copyright 2020-2023 David Robillard <d@drobilla.net>
+// SPDX-License-Identifier: ISC
+
+/*
+  Benchmark for compiling large generated patterns.
+
+  This compiles an alternation of many words, like a generated enumeration,
+  and one long literal, at sizes up to several megabytes.  The time per byte
+  should be roughly constant, since compilation scales linearly.
+*/
+
+#include "rerex/rerex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define SIZE_MAX_LOG2 22U
+#define WORD_LEN 8U
+
+// Return a pattern of about `size` bytes, an alternation of words or a literal
+static char*
+make_pattern(const size_t size, const bool alternation)
+{
+  char* const pattern = (char*)calloc(size + 1U, 1U);
+  unsigned    seed    = 1U;
+
+  if (!pattern) {
+    return NULL;
+  }
+
+  for (size_t i = 0U; i < size; ++i) {
+    seed = (seed * 1103515245U) + 12345U;
+
+    pattern[i] = (alternation && i % (WORD_LEN + 1U) == WORD_LEN)
+                   ? '|'
+                   : (char)('a' + ((seed >> 16U) % 26U));
+  }
+
+  if (size && pattern[size - 1U] == '|') {
+    pattern[size - 1U] = 'z';
+  }
+
+  return pattern;
+}
+
+static int
+run(const size_t size, const bool alternation)
+{
+  char* const   regexp  = make_pattern(size, alternation);
+  RerexPattern* pattern = NULL;
+  size_t        end     = 0U;
+  const clock_t begin   = clock();
+
+  if (!regexp || rerex_compile(regexp, &end, &pattern)) {
+    free(regexp);
+    return 1;
+  }
+
+  const double seconds = (double)(clock() - begin) / CLOCKS_PER_SEC;
+
+  printf("%-11s %9zu %10.3f %8.1f\n",
+         alternation ? "alternation" : "literal",
+         size,
+         seconds * 1.0e3,
+         seconds * 1.0e9 / (double)size);
+
+  rerex_free_pattern(pattern);
+  free(regexp);
+  return 0;
+}
+
+int
+main(void)
+{
+  printf("# Pattern       Bytes         ms  ns/byte\n");
+  for (unsigned i = 0U; i < 2U; ++i) {
+    for (size_t size = 1024U; size <= (1U << SIZE_MAX_LOG2); size *= 4U) {
+      if (run(size, i == 0U)) {
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,91 @@
+// Copyright 2020-2023 David Robillard <d@drobilla.net>
+// SPDX-License-Identifier: ISC
+
+/*
+  Benchmark for the overhead of a match call with patterns of various sizes.
+
+  Each pattern has two start positions followed by an alternation of many
+  words, and is matched against a short string that fails at the first byte,
+  so the time is dominated by the per-call overhead of the matcher.
+*/
+
+#include "rerex/rerex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define N_WORDS_MAX 4096U
+#define WORD_LEN 8U
+
+// Return a pattern like "(x|y)(abcdefgh|...)" with `n_words` random words
+static char*
+make_pattern(const size_t n_words)
+{
+  char* const pattern = (char*)calloc((n_words * (WORD_LEN + 1U)) + 8U, 1U);
+  size_t      len     = 6U;
+  unsigned    seed    = 1U;
+
+  if (!pattern) {
+    return NULL;
+  }
+
+  memcpy(pattern, "(x|y)(", len);
+  for (size_t w = 0U; w < n_words; ++w) {
+    if (w) {
+      pattern[len++] = '|';
+    }
+
+    for (size_t i = 0U; i < WORD_LEN; ++i) {
+      seed           = (seed * 1103515245U) + 12345U;
+      pattern[len++] = (char)('a' + ((seed >> 16U) % 26U));
+    }
+  }
+
+  pattern[len] = ')';
+  return pattern;
+}
+
+static int
+run(const size_t n_words, const size_t n_calls)
+{
+  char* const   regexp  = make_pattern(n_words);
+  RerexPattern* pattern = NULL;
+  size_t        end     = 0U;
+
+  if (!regexp || rerex_compile(regexp, &end, &pattern)) {
+    free(regexp);
+    return 1;
+  }
+
+  RerexMatcher* const matcher = rerex_new_matcher(pattern);
+  const clock_t       begin   = clock();
+  size_t              n_match = 0U;
+
+  for (size_t i = 0U; i < n_calls; ++i) {
+    n_match += rerex_match_n(matcher, "zabcdefgh", 1U + WORD_LEN) ? 1U : 0U;
+  }
+
+  const double seconds = (double)(clock() - begin) / CLOCKS_PER_SEC;
+
+  printf("%8zu %10.1f\n", n_words, seconds * 1.0e9 / (double)n_calls);
+
+  rerex_free_matcher(matcher);
+  rerex_free_pattern(pattern);
+  free(regexp);
+  return n_match != 0U;
+}
+
+int
+main(void)
+{
+  printf("# Words  ns/match\n");
+  for (size_t n_words = 64U; n_words <= N_WORDS_MAX; n_words *= 4U) {
+    if (run(n_words, 1000000U)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
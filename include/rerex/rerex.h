@@ -6,6 +6,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 // REREX_API must be used to decorate things in the public API
 #ifndef REREX_API
@@ -43,14 +44,167 @@ typedef enum {
   REREX_UNEXPECTED_END,
   REREX_UNORDERED_RANGE,
   REREX_NO_MEMORY,
+  REREX_TOO_MANY_STATES,
+  REREX_BAD_STATE,
 } RerexStatus;
 
+/// Flag for how a pattern is compiled
+typedef enum {
+  /**
+     Match arbitrary bytes.
+
+     By default, only printable ASCII characters are matched, so '.' and
+     negated sets like "[^a]" match any character from 0x20 to 0x7E.  With
+     this flag, they instead match any byte from 0x00 to 0xFF, including NUL,
+     which is useful for matching binary data with rerex_match_n().
+  */
+  REREX_BYTES = 1U << 0U,
+
+  /**
+     Count states before building to allocate exactly once.
+
+     By default, the array of states built while parsing grows as necessary.
+     With this flag, the pattern is scanned first to count the states, so the
+     array is allocated once at exactly the right size.  This avoids wasting
+     memory and copying for very large patterns, at the cost of an extra pass
+     over the pattern string.
+  */
+  REREX_EXACT_SIZE = 1U << 1U,
+
+  /**
+     Always match by simulating the NFA with lists of positions.
+
+     By default, the engine used for matching is chosen when the pattern is
+     compiled, based on its size and structure (see rerex_engine()).  This
+     flag, or one of the other "force" flags, overrides that choice, which is
+     useful for benchmarking, or for predictable memory use.  If several are
+     given, the first in this list takes precedence.  With this flag, no
+     bit-parallel tables are built at all.
+  */
+  REREX_FORCE_NFA = 1U << 2U,
+
+  /**
+     Always match by simulating the NFA with sets of positions in words.
+
+     Compiling fails with #REREX_TOO_MANY_STATES if the pattern has more than
+     256 positions, which is roughly one per character or set.
+  */
+  REREX_FORCE_BITS = 1U << 3U,
+
+  /**
+     Always match with a complete DFA built at compile time.
+
+     Compiling fails with #REREX_TOO_MANY_STATES if the DFA would have more
+     than 4096 states.  Use rerex_compile_dfa() for a different limit.
+  */
+  REREX_FORCE_DFA = 1U << 4U,
+} RerexFlag;
+
+/// Bitwise OR of #RerexFlag values
+typedef uint32_t RerexFlags;
+
+/// Progress of an incremental match
+typedef enum {
+  REREX_DEAD,      ///< The input can't match, regardless of what follows
+  REREX_VIABLE,    ///< The input doesn't match, but could with more input
+  REREX_ACCEPTING, ///< The input matches, though more input may not
+} RerexProgress;
+
+/// Which match to find when searching a string
+typedef enum {
+  REREX_LEFTMOST_LONGEST,  ///< The longest of the matches that start first
+  REREX_LEFTMOST_SHORTEST, ///< The shortest of the matches that start first
+} RerexSearchMode;
+
+/// Strategy used to match strings against a pattern
+typedef enum {
+  REREX_ENGINE_NFA,     ///< Simulate the NFA with lists of active positions
+  REREX_ENGINE_BITS,    ///< Simulate the NFA with sets of positions in words
+  REREX_ENGINE_DFA,     ///< Follow a complete DFA built ahead of time
+  REREX_ENGINE_LITERAL, ///< Compare with the only string that matches
+} RerexEngine;
+
+/// A string with an explicit length, which needn't be null-terminated
+typedef struct {
+  const char* data; ///< Pointer to the first character
+  size_t      len;  ///< Number of characters
+} RerexStringView;
+
+/**
+   A task that matches one chunk of a parallel batch.
+
+   This must be called with the `data` passed to the executor, the index of
+   the calling `worker`, and the `index` of the chunk to match.
+*/
+typedef void (*RerexTask)(void* data, size_t worker, size_t index);
+
+/**
+   A function that runs tasks, possibly in parallel.
+
+   An executor must call `task(data, worker, index)` exactly once for every
+   `index` from zero to `n_tasks - 1`, then return when they have all finished.
+   Each call must pass a `worker` less than `n_workers`, and no two calls with
+   the same `worker` may run at the same time, so a worker usually corresponds
+   to a thread.  Tasks may run in any order, so a pool where idle threads take
+   the next index from a shared atomic counter works well.
+*/
+typedef void (*RerexExecutor)(void*     context,
+                              size_t    n_workers,
+                              size_t    n_tasks,
+                              RerexTask task,
+                              void*     data);
+
+/**
+   A memory allocator.
+
+   This is a table of functions like the standard C ones, which is passed as
+   the first argument to each so that allocators can have state.  To do so, a
+   custom allocator can be a struct with a RerexAllocator as its first member,
+   followed by any data it needs, like an arena to allocate from.
+
+   Everything allocated for a pattern, matcher, or set, including temporary
+   memory, uses the allocator it was created with.
+*/
+typedef struct RerexAllocatorImpl RerexAllocator;
+
+/// Allocate `size` bytes like malloc()
+typedef void* (*RerexMallocFunc)(RerexAllocator* allocator, size_t size);
+
+/// Allocate an array of `nmemb` zeroed elements of `size` bytes like calloc()
+typedef void* (*RerexCallocFunc)(RerexAllocator* allocator,
+                                 size_t          nmemb,
+                                 size_t          size);
+
+/// Resize memory at `ptr` to `size` bytes like realloc()
+typedef void* (*RerexReallocFunc)(RerexAllocator* allocator,
+                                  void*           ptr,
+                                  size_t          size);
+
+/// Free memory at `ptr` (which may be null) like free()
+typedef void (*RerexFreeFunc)(RerexAllocator* allocator, void* ptr);
+
+/// Functions to allocate and free memory
+struct RerexAllocatorImpl {
+  RerexMallocFunc  malloc;  ///< Allocate memory
+  RerexCallocFunc  calloc;  ///< Allocate zeroed memory
+  RerexReallocFunc realloc; ///< Resize memory
+  RerexFreeFunc    free;    ///< Free memory
+};
+
 /// Pattern that represents a compiled valid regular expression
 typedef struct RerexPatternImpl RerexPattern;
 
 /// Matcher that can be used to match strings against a pattern
 typedef struct RerexMatcherImpl RerexMatcher;
 
+/// Set of patterns that can be matched together in a single pass
+typedef struct RerexSetImpl RerexSet;
+
+/// Return the default allocator, which uses the standard C functions
+REREX_CONST_API
+RerexAllocator*
+rerex_default_allocator(void);
+
 /// Return a human-readable description of `status`
 REREX_CONST_API
 const char*
@@ -71,22 +225,432 @@ REREX_API
 RerexStatus
 rerex_compile(const char* pattern, size_t* end, RerexPattern** out);
 
+/**
+   Build a regular expression from a pattern string with flags.
+
+   This is the same as rerex_compile(), except `flags` controls how the
+   pattern is interpreted.
+*/
+REREX_API
+RerexStatus
+rerex_compile_flags(const char*    pattern,
+                    RerexFlags     flags,
+                    size_t*        end,
+                    RerexPattern** out);
+
+/**
+   Build a regular expression from a pattern string with a custom allocator.
+
+   This is the same as rerex_compile_flags(), except everything is allocated
+   with `allocator`, or the default allocator if it is null.  The allocator
+   must outlive the pattern, which is freed with it by rerex_free_pattern().
+   Matchers for the pattern use the same allocator by default.
+*/
+REREX_API
+RerexStatus
+rerex_compile_alloc(RerexAllocator* allocator,
+                    const char*     pattern,
+                    RerexFlags      flags,
+                    size_t*         end,
+                    RerexPattern**  out);
+
+/**
+   Return the literal prefix of a pattern.
+
+   This is the longest string that every string matching the pattern starts
+   with, which may be empty.  Strings without this prefix are rejected without
+   running the automaton at all.
+*/
+REREX_API
+const char*
+rerex_prefix(const RerexPattern* pattern);
+
+/**
+   Return the literal suffix of a pattern.
+
+   This is the longest string that every string matching the pattern ends
+   with, which may be empty.  Strings without this suffix are rejected without
+   running the automaton at all.
+*/
+REREX_API
+const char*
+rerex_suffix(const RerexPattern* pattern);
+
+/**
+   Return the length of the shortest string that matches a pattern.
+
+   Strings shorter than this are rejected without running the automaton.
+*/
+REREX_API
+size_t
+rerex_min_length(const RerexPattern* pattern);
+
+/**
+   Return the length of the longest string that matches a pattern.
+
+   Strings longer than this are rejected without running the automaton.  If
+   the pattern has no such limit, like "a*", then this returns `SIZE_MAX`.
+*/
+REREX_API
+size_t
+rerex_max_length(const RerexPattern* pattern);
+
+/**
+   Compile a complete DFA for a pattern.
+
+   This builds a DFA for the pattern ahead of time, so that matching only does
+   a single table lookup per input character.  This can be much faster than
+   the default NFA simulation, but takes time and memory up front, and the
+   number of DFA states can be exponential in the size of the pattern.  So,
+   construction is stopped if the DFA would have more than `max_states` states
+   (including a "dead" state which rejects all input).
+
+   This modifies the pattern, so must not be called while a matcher for the
+   pattern is matching, for example in another thread.  Existing matchers
+   remain valid, including any stream in progress, and use the DFA for every
+   whole string they match afterwards.
+
+   @return #REREX_SUCCESS, #REREX_TOO_MANY_STATES if the DFA would have too
+   many states, or #REREX_NO_MEMORY if allocation failed.  On error, the
+   pattern is unchanged, so matching still works using the NFA.
+*/
+REREX_API
+RerexStatus
+rerex_compile_dfa(RerexPattern* pattern, size_t max_states);
+
+/**
+   Return the engine used to match strings against a pattern.
+
+   This is chosen cheaply when the pattern is compiled, from its size, byte
+   classes, and literals.  Patterns that only match a single string are
+   compared with it directly.  Patterns with up to 32 positions and byte
+   classes get a complete DFA, unless it has many more states than the
+   pattern has positions, or literals already make up most of every match.
+   Everything else is simulated, with bit sets if there are at most 256
+   positions.  A successful call to rerex_compile_dfa() switches the pattern
+   to #REREX_ENGINE_DFA.
+
+   Matchers with a lazy DFA cache (see rerex_set_cache_size()) use it instead
+   of simulating the NFA with either #REREX_ENGINE_NFA or #REREX_ENGINE_BITS,
+   so for larger patterns, a cache is usually the fastest way to match.
+*/
+REREX_API
+RerexEngine
+rerex_engine(const RerexPattern* pattern);
+
+/**
+   Return a short description of why the engine of a pattern was chosen.
+
+   This is a static string for diagnostics, like "DFA is small enough to build
+   ahead of time", which is never null.
+*/
+REREX_API
+const char*
+rerex_engine_reason(const RerexPattern* pattern);
+
 /**
    Allocate a new matcher for matching against a pattern.
 
    The returned matcher can be used to match several strings against a single
-   pattern using rerex_match().  It is newly allocated and must be freed with
-   rerex_free_matcher().
+   pattern using rerex_match().  It is newly allocated with the allocator of
+   the pattern, and must be freed with rerex_free_matcher().
 */
 REREX_API
 RerexMatcher*
 rerex_new_matcher(const RerexPattern* regexp);
 
+/**
+   Allocate a new matcher with a custom allocator.
+
+   This is the same as rerex_new_matcher(), except everything for the matcher
+   is allocated with `allocator`, or the default allocator if it is null.
+*/
+REREX_API
+RerexMatcher*
+rerex_new_matcher_alloc(RerexAllocator* allocator, const RerexPattern* regexp);
+
+/**
+   Set the size of the lazy DFA cache of a matcher.
+
+   By default, a matcher simulates the NFA of the pattern directly, which does
+   work proportional to the number of active states for every input character.
+   With a cache, the matcher instead builds a DFA on the fly, and remembers
+   every transition it computes, so matching a character that follows a
+   previously seen path is a single table lookup.
+
+   The cache uses at most `size` bytes.  It is flushed when it is full, and if
+   it is flushed too frequently to be useful, matching falls back to NFA
+   simulation.  A size of zero, or one too small to be useful for the pattern,
+   disables the cache.
+
+   The cache is only used if the pattern is simulated, which is the case for
+   most patterns with more than a few characters (see rerex_engine()).  Small
+   patterns get a complete DFA when they are compiled, which is used instead,
+   and patterns that only match a literal string don't need either.
+
+   @return #REREX_SUCCESS, or #REREX_NO_MEMORY if allocation failed, in which
+   case the cache is disabled.
+*/
+REREX_API
+RerexStatus
+rerex_set_cache_size(RerexMatcher* matcher, size_t size);
+
 /// Return true if `string` matches the pattern of `matcher`
 REREX_API
 bool
 rerex_match(RerexMatcher* matcher, const char* string);
 
+/**
+   Return true if a string with a known length matches the pattern.
+
+   This is equivalent to rerex_match(), except the length of `string` is given
+   as `len` bytes, and it doesn't need to be null-terminated, so a slice of a
+   larger buffer can be matched in place.  Null bytes in the string are
+   treated like any other, so can only be matched by '.' or a negated set in a
+   pattern compiled with #REREX_BYTES.
+   Since the shortest and longest possible matches are known when the pattern
+   is compiled, strings with an impossible length are rejected immediately,
+   without looking at their contents.
+*/
+REREX_API
+bool
+rerex_match_n(RerexMatcher* matcher, const char* string, size_t len);
+
+/**
+   Return the size of the scratch memory needed to match against a pattern.
+
+   This is the size in bytes of the buffer that must be passed to
+   rerex_match_scratch(), which is proportional to the size of the pattern.
+*/
+REREX_API
+size_t
+rerex_matcher_size(const RerexPattern* pattern);
+
+/**
+   Match a string using caller-provided scratch memory.
+
+   This matches like rerex_match_n(), but without a matcher, so it never
+   allocates.  Instead, the matching state is stored in `scratch`, which must
+   be at least rerex_matcher_size() bytes and suitably aligned for any type,
+   like memory from malloc() or a stack array of `size_t`.  The contents of
+   the scratch memory needn't be initialized, and aren't meaningful after
+   matching.
+
+   The pattern is only read, so it can be matched from several threads at
+   once, provided each uses its own scratch memory.  A lazy DFA cache is never
+   used, but a complete DFA is (see rerex_compile_dfa()).
+*/
+REREX_API
+bool
+rerex_match_scratch(const RerexPattern* pattern,
+                    void*               scratch,
+                    const char*         string,
+                    size_t              len);
+
+/**
+   Match a batch of strings.
+
+   This matches every string in the array `strings` of length `n`, like
+   rerex_match_n(), but faster than calling it for each if the pattern has a
+   complete DFA, since several strings are then matched at once.
+
+   The results are written to the packed bitmap `results`, which must have
+   room for at least `(n + 7) / 8` bytes.  Bit `i % 8` of byte `i / 8` (where
+   bit 0 is the least significant) is set if string `i` matches, and any unused
+   bits in the last byte are cleared.  This is the layout of a validity bitmap
+   in Apache Arrow.
+*/
+REREX_API
+void
+rerex_match_batch(RerexMatcher*          matcher,
+                  const RerexStringView* strings,
+                  size_t                 n,
+                  uint8_t*               results);
+
+/**
+   Match a batch of strings in parallel.
+
+   This is like rerex_match_batch(), but splits the batch into chunks that are
+   matched by up to `n_workers` workers, each with its own matcher.  Rerex
+   doesn't create any threads itself: the chunks are run by calling
+   `executor`, which is passed `context`.  If `executor` is null, then every
+   chunk is matched by the calling thread.
+
+   The batch is split into about 4 chunks per worker, each a multiple of 64
+   strings, up to 512.  So, no two workers write to the same byte of
+   `results`, and for large batches with a bitmap aligned to 64 bytes, no two
+   write to the same cache line.
+
+   The pattern is shared by every worker, and must not be modified until this
+   returns.  The results are the same as rerex_match_batch(), but the matches
+   are all made by a simulation or a complete DFA, since workers have no lazy
+   DFA cache.
+
+   @return #REREX_SUCCESS, or #REREX_NO_MEMORY if allocating the matchers
+   failed, in which case the results aren't written.
+*/
+REREX_API
+RerexStatus
+rerex_match_parallel(const RerexPattern*    pattern,
+                     const RerexStringView* strings,
+                     size_t                 n,
+                     uint8_t*               results,
+                     size_t                 n_workers,
+                     RerexExecutor          executor,
+                     void*                  context);
+
+/**
+   Match a single long string in parallel.
+
+   This matches like rerex_match_n(), but if the pattern has a complete DFA
+   (see rerex_compile_dfa()), then long strings are split into chunks that are
+   matched in parallel by calling `executor` as in rerex_match_parallel().
+   Since the state at the start of a chunk isn't known in advance, each chunk
+   is matched from every DFA state, so this only pays off with several workers
+   and a DFA with few states.  If the pattern has no complete DFA, the DFA has
+   more live states (excluding the dead state) than `n_workers` or 16, or the
+   string is short, then it is matched on the calling thread.
+
+   @param pattern The pattern to match against.
+   @param string The string to match.
+   @param len The length of `string` in bytes.
+   @param n_workers The number of workers to pass to `executor`.
+   @param executor The executor to run chunks, or null to not use one.
+   @param context The context to pass to `executor`.
+   @param[out] match Set to true if the string matches.
+
+   @return #REREX_SUCCESS, or #REREX_NO_MEMORY if allocation failed.
+*/
+REREX_API
+RerexStatus
+rerex_match_chunked(const RerexPattern* pattern,
+                    const char*         string,
+                    size_t              len,
+                    size_t              n_workers,
+                    RerexExecutor       executor,
+                    void*               context,
+                    bool*               match);
+
+/**
+   Match a batch of strings stored contiguously, like an Arrow string array.
+
+   This is like rerex_match_batch(), but the `n` strings are stored one after
+   another in `data`, where string `i` starts at offset `offsets[i]` and ends
+   at offset `offsets[i + 1]`, so `offsets` has `n + 1` elements.
+*/
+REREX_API
+void
+rerex_match_offsets(RerexMatcher*  matcher,
+                    const char*    data,
+                    const int32_t* offsets,
+                    size_t         n,
+                    uint8_t*       results);
+
+/**
+   Search for a match anywhere in a string.
+
+   Unlike rerex_match(), which only matches entire strings, this finds a match
+   of the pattern within `string`, which has length `len`.  On success, the
+   match is the substring from offset `start` up to (but not including) offset
+   `end`.  If there are several matches, `mode` chooses between them.
+
+   Either `start` or `end` may be null if it isn't needed.  If both are null,
+   then the search stops as soon as any match is found, which is faster if
+   only whether there is a match is needed.
+
+   @return True if a match was found.
+*/
+REREX_API
+bool
+rerex_search(RerexMatcher*   matcher,
+             const char*     string,
+             size_t          len,
+             RerexSearchMode mode,
+             size_t*         start,
+             size_t*         end);
+
+/**
+   Find the next match in a string, to iterate over every match.
+
+   This is like rerex_search(), but searches from `offset` and advances it past
+   the found match, so calling this repeatedly from a zero offset finds every
+   match that doesn't overlap a previous one.  For example:
+
+   @code{.c}
+   size_t offset = 0;
+   size_t start  = 0;
+   size_t end    = 0;
+   while (rerex_find_next(matcher, str, len, mode, &offset, &start, &end)) {
+     // Do something with the match from start to end
+   }
+   @endcode
+
+   @return True if a match was found, or false if there are no more matches.
+*/
+REREX_API
+bool
+rerex_find_next(RerexMatcher*   matcher,
+                const char*     string,
+                size_t          len,
+                RerexSearchMode mode,
+                size_t*         offset,
+                size_t*         start,
+                size_t*         end);
+
+/**
+   Reset a matcher to start matching a new stream.
+
+   A stream is an input that is matched incrementally with
+   rerex_matcher_feed(), so it doesn't need to be in memory all at once.  A new
+   matcher is ready to start a stream, and rerex_matcher_finish() resets it, so
+   this is only needed to abandon a stream part way through.  Matching or
+   searching a whole string with another function also abandons any stream.
+*/
+REREX_API
+void
+rerex_matcher_reset(RerexMatcher* matcher);
+
+/**
+   Feed the next chunk of a stream to a matcher.
+
+   @return The progress of the stream so far, which can be used to stop
+   reading early: after #REREX_DEAD, nothing that follows can make the stream
+   match.
+*/
+REREX_API
+RerexProgress
+rerex_matcher_feed(RerexMatcher* matcher, const char* chunk, size_t len);
+
+/// Finish a stream, and return true if everything fed since reset matches
+REREX_API
+bool
+rerex_matcher_finish(RerexMatcher* matcher);
+
+/**
+   Save the state of a stream part way through.
+
+   The state is written to `state` as up to `n` integers, which can be given
+   to rerex_matcher_restore() to resume the stream later.  It only depends on
+   the pattern, so can be restored in another process with a pattern compiled
+   from the same string with the same flags.
+
+   @return The number of integers in the state.  If this is greater than `n`,
+   then nothing is written, so calling this with zero `n` returns the size.
+*/
+REREX_API
+size_t
+rerex_matcher_save(const RerexMatcher* matcher, size_t* state, size_t n);
+
+/**
+   Restore the state of a stream saved with rerex_matcher_save().
+
+   @return #REREX_SUCCESS, or #REREX_BAD_STATE if `state` isn't a valid state
+   for the pattern, in which case the matcher is unchanged.
+*/
+REREX_API
+RerexStatus
+rerex_matcher_restore(RerexMatcher* matcher, const size_t* state, size_t n);
+
 /// Free a matcher allocated with rerex_new_matcher()
 REREX_API
 void
@@ -97,6 +661,115 @@ REREX_API
 void
 rerex_free_pattern(RerexPattern* expression);
 
+/**
+   Build a set of patterns that can be matched together.
+
+   The patterns are merged into a single automaton, so a string can be matched
+   against every pattern in one pass, rather than once per pattern.  Each
+   pattern is identified by an ID, which is also its priority, where lower IDs
+   come first.  The patterns given here have their index in `patterns` as
+   their ID, and the set can be empty.  The set doesn't refer to the patterns,
+   which can be freed afterwards.
+
+   @return A newly allocated set which must be freed with rerex_free_set(), or
+   null if allocation failed.
+*/
+REREX_API
+RerexSet*
+rerex_new_set(const RerexPattern* const* patterns, size_t n_patterns);
+
+/**
+   Build a set of patterns with a custom allocator.
+
+   This is the same as rerex_new_set(), except everything is allocated with
+   `allocator`, or the default allocator if it is null.  The allocator must
+   outlive the set, and matchers for the set use it too.
+*/
+REREX_API
+RerexSet*
+rerex_new_set_alloc(RerexAllocator*           allocator,
+                    const RerexPattern* const* patterns,
+                    size_t                     n_patterns);
+
+/**
+   Add a pattern to a set.
+
+   This takes time proportional to the size of `pattern`, not the set, so sets
+   can be changed frequently.  The set must not be modified while it is being
+   used by a matcher, but matchers can be used as before afterwards.
+
+   @param set The set to add the pattern to.
+   @param pattern The pattern to add, which can be freed afterwards.
+   @param[out] id Set to the ID of the added pattern, which is the ID of a
+   removed pattern if there is one, or otherwise one greater than the highest
+   ID in the set.
+
+   @return #REREX_SUCCESS, or #REREX_NO_MEMORY if allocation failed, in which
+   case the set is unchanged.
+*/
+REREX_API
+RerexStatus
+rerex_set_add(RerexSet* set, const RerexPattern* pattern, size_t* id);
+
+/**
+   Remove a pattern from a set.
+
+   This takes time proportional to the size of the removed pattern, amortized
+   over all removals, since space is occasionally reclaimed by compacting the
+   set.  The set must not be modified while it is being used by a matcher.
+
+   @return True if the pattern was removed, or false if there is no pattern in
+   the set with the given ID.
+*/
+REREX_API
+bool
+rerex_set_remove(RerexSet* set, size_t id);
+
+/// Free a set allocated with rerex_new_set()
+REREX_API
+void
+rerex_free_set(RerexSet* set);
+
+/**
+   Allocate a new matcher for matching against a set of patterns.
+
+   The returned matcher can only be used with rerex_set_match() and
+   rerex_set_match_first().  It must be freed with rerex_free_matcher().
+*/
+REREX_API
+RerexMatcher*
+rerex_new_set_matcher(const RerexSet* set);
+
+/**
+   Find every pattern in a set that matches a string.
+
+   The ID of every matching pattern is written to `ids` in increasing order, so
+   it must have space for as many IDs as there are patterns in the set.  If the
+   set has grown since the matcher was last used, then the matcher is enlarged
+   first, and if that fails, no patterns match.
+
+   @return The number of matching patterns written to `ids`.
+*/
+REREX_API
+size_t
+rerex_set_match(RerexMatcher* matcher,
+                const char*   string,
+                size_t        len,
+                size_t*       ids);
+
+/**
+   Find the first pattern in a set that matches a string.
+
+   This is like rerex_set_match(), but only finds the matching pattern with
+   the highest priority.
+
+   @return The lowest ID of a matching pattern, or `SIZE_MAX` if no patterns
+   match.
+*/
+REREX_API
+size_t
+rerex_set_match_first(RerexMatcher* matcher, const char* string, size_t len);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
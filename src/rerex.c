@@ -8,9 +8,104 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 static const char cmin = 0x20; // Inclusive minimum normal character
 static const char cmax = 0x7E; // Inclusive maximum normal character
+static const int  bmin = 0x00; // Inclusive minimum byte with REREX_BYTES
+static const int  bmax = 0xFF; // Inclusive maximum byte with REREX_BYTES
+
+/* Memory allocation.
+
+   Everything is allocated with an allocator, which is either provided by the
+   user, or the default that uses the standard C functions.
+*/
+
+static void*
+default_malloc(RerexAllocator* const allocator, const size_t size)
+{
+  (void)allocator;
+  return malloc(size);
+}
+
+static void*
+default_calloc(RerexAllocator* const allocator,
+               const size_t          nmemb,
+               const size_t          size)
+{
+  (void)allocator;
+  return calloc(nmemb, size);
+}
+
+static void*
+default_realloc(RerexAllocator* const allocator,
+                void* const           ptr,
+                const size_t          size)
+{
+  (void)allocator;
+  return realloc(ptr, size);
+}
+
+static void
+default_free(RerexAllocator* const allocator, void* const ptr)
+{
+  (void)allocator;
+  free(ptr);
+}
+
+RerexAllocator*
+rerex_default_allocator(void)
+{
+  static RerexAllocator default_allocator = {
+    default_malloc,
+    default_calloc,
+    default_realloc,
+    default_free,
+  };
+
+  return &default_allocator;
+}
+
+// Return `allocator`, or the default allocator if it's null
+static RerexAllocator*
+get_allocator(RerexAllocator* const allocator)
+{
+  return allocator ? allocator : rerex_default_allocator();
+}
+
+static void*
+mem_calloc(RerexAllocator* const allocator,
+           const size_t          nmemb,
+           const size_t          size)
+{
+  return allocator->calloc(allocator, nmemb, size);
+}
+
+static void*
+mem_realloc(RerexAllocator* const allocator,
+            void* const           ptr,
+            const size_t          size)
+{
+  return allocator->realloc(allocator, ptr, size);
+}
+
+static void
+mem_free(RerexAllocator* const allocator, void* const ptr)
+{
+  allocator->free(allocator, ptr);
+}
+
+// Shrink an allocation to `size` bytes if possible, and return it
+static void*
+mem_shrink(RerexAllocator* const allocator,
+           void* const           ptr,
+           const size_t          size)
+{
+  // If shrinking fails, the original is still valid and just wastes space
+  void* const shrunk = size ? mem_realloc(allocator, ptr, size) : NULL;
+
+  return shrunk ? shrunk : ptr;
+}
 
 const char*
 rerex_strerror(const RerexStatus status)
@@ -26,17 +121,25 @@ rerex_strerror(const RerexStatus status)
     "Unexpected end of input",
     "Range is out of order",
     "Failed to allocate memory",
+    "Too many DFA states",
+    "Invalid matcher state",
   };
 
-  return ((unsigned)status <= (unsigned)REREX_NO_MEMORY)
+  return ((unsigned)status <= (unsigned)REREX_BAD_STATE)
            ? status_strings[status]
            : "Unknown error";
 }
 
 /* State */
 
-// The ID for a state, which is an index into the state array
-typedef size_t StateIndex;
+/* The ID for a state, which is an index into the state array.
+
+   Indices are 32 bits, which is plenty for any realistic pattern, and halves
+   the size of states, positions, follow lists, and active lists compared to
+   using size_t on 64-bit systems.  Compilation fails with REREX_NO_MEMORY if a
+   pattern is too large to index.
+*/
+typedef uint32_t StateIndex;
 
 // A code point (currently only 8-bit ASCII but we use the space anyway)
 typedef int Codepoint;
@@ -45,6 +148,7 @@ typedef int Codepoint;
 typedef enum {
   REREX_MATCH = 0xE000, ///< Matching state, no out arcs
   REREX_SPLIT = 0xE001, ///< Splitting state, one or two out arcs
+  REREX_CLASS = 0xE002, ///< Character class state, one arc labeled by a set
 } StateType;
 
 /* A state in an NFA.
@@ -54,7 +158,9 @@ typedef enum {
    other states.  There is both a minimum and maximum label for supporting
    character ranges.  So, either `min` and `max` are ASCII characters that are
    the label of an arc to next1 (and next2 is null), or `min` is a special
-   StateType and next1 and/or next2 may be set to successor states.
+   StateType and next1 and/or next2 may be set to successor states.  As a
+   special case, a character class state has a single arc to next1 labeled by
+   an arbitrary set of characters, and `max` is the index of that set.
 */
 typedef struct {
   StateIndex next1; ///< Head of first out arc (or NULL)
@@ -84,43 +190,163 @@ split_state(const StateIndex next1, const StateIndex next2)
 
 // Create a labeled state with one successor reached by a character arc
 static State
-range_state(const char min, const char max, const StateIndex next)
+range_state(const Codepoint min, const Codepoint max, const StateIndex next)
 {
   const State s = {next, NO_STATE, min, max};
   return s;
 }
 
+// Create a class state with one successor reached by an arc labeled by a set
+static State
+class_state(const size_t set, const StateIndex next)
+{
+  const State s = {next, NO_STATE, REREX_CLASS, (Codepoint)set};
+  return s;
+}
+
+// Return whether `state` has a labeled arc (and is not a special state)
+static bool
+is_labeled(const State* const state)
+{
+  return state->min != REREX_MATCH && state->min != REREX_SPLIT;
+}
+
+/* Character set.
+
+   A set of characters is a bitmap with a bit for every possible byte, which is
+   used as the label of a single state for a bracket expression, regardless of
+   how many ranges it contains.
+*/
+typedef struct {
+  uint64_t words[4];
+} CharSet;
+
+// Add every character in the range from `min` to `max` to `set`
+static void
+add_range(CharSet* const set, const Codepoint min, const Codepoint max)
+{
+  for (Codepoint c = min; c <= max; ++c) {
+    set->words[c / 64] |= (uint64_t)1U << (c % 64);
+  }
+}
+
+// Return whether `set` contains the character `c`
+static bool
+set_contains(const CharSet* const set, const char c)
+{
+  const uint8_t byte = (uint8_t)c;
+
+  return (set->words[byte / 64U] >> (byte % 64U)) & 1U;
+}
+
 /* Array of states.
 
    States are stored in a flat array to reduce memory fragmentation, and for
-   easy memory management since the automata graph may be cyclic.  This simple
-   implementation calls realloc() for every state, which isn't terribly
-   efficient, but works well enough.  Note that state addresses therefore change
-   during compilation, so states are generally referred to by their index, and
-   not by pointer.  Conveniently, using indices is also useful during matching
-   for storing auxiliary information about states.
+   easy memory management since the automata graph may be cyclic.  The array
+   grows by doubling, so adding a state takes amortized constant time, or can
+   be reserved at exactly the right size in advance by counting the states
+   first.  Note that state addresses therefore change during compilation, so
+   states are generally referred to by their index, and not by pointer.
+   Conveniently, using indices is also useful during matching for storing
+   auxiliary information about states.
 */
 typedef struct {
-  State* states;
-  size_t n_states;
+  State*          states;          ///< States
+  size_t          n_states;        ///< Number of states
+  size_t          states_capacity; ///< Number of states there is room for
+  CharSet*        sets;            ///< Labels of character class states
+  size_t          n_sets;          ///< Number of sets
+  size_t          sets_capacity;   ///< Number of sets there is room for
+  RerexAllocator* allocator;       ///< Allocator for arrays
+  bool            failed;          ///< Whether an allocation failed
 } StateArray;
 
+// Return a capacity of at least `n`, by doubling `capacity` until it fits
+static size_t
+grow_capacity(const size_t capacity, const size_t n)
+{
+  size_t result = capacity ? capacity : 16U;
+  while (result < n) {
+    result *= 2U;
+  }
+
+  return result;
+}
+
+// Resize the arrays of a state array to hold exactly the given number of items
+static void
+reserve_states(StateArray* const array,
+               const size_t      n_states,
+               const size_t      n_sets)
+{
+  if (n_states != array->states_capacity) {
+    State* const new_states = (State*)mem_realloc(
+      array->allocator, array->states, n_states * sizeof(State));
+    if (new_states) {
+      array->states          = new_states;
+      array->states_capacity = n_states;
+    }
+  }
+
+  if (n_sets && n_sets != array->sets_capacity) {
+    CharSet* const new_sets = (CharSet*)mem_realloc(
+      array->allocator, array->sets, n_sets * sizeof(CharSet));
+    if (new_sets) {
+      array->sets          = new_sets;
+      array->sets_capacity = n_sets;
+    }
+  }
+}
+
 // Append a new state to the end of the state array
 static StateIndex
 add_state(StateArray* const array, const State state)
 {
-  const size_t new_index    = array->n_states;
-  const size_t new_n_states = new_index + 1U;
-  const size_t new_size     = new_n_states * sizeof(State);
-  State* const new_states   = (State*)realloc(array->states, new_size);
+  if (array->n_states >= UINT32_MAX) {
+    array->failed = true; // Too many states for a 32-bit index
+    return NO_STATE;
+  }
+
+  if (array->n_states == array->states_capacity) {
+    const size_t capacity =
+      grow_capacity(array->states_capacity, array->n_states + 1U);
+
+    State* const new_states = (State*)mem_realloc(
+      array->allocator, array->states, capacity * sizeof(State));
+    if (!new_states) {
+      array->failed = true;
+      return NO_STATE;
+    }
+
+    array->states          = new_states;
+    array->states_capacity = capacity;
+  }
+
+  array->states[array->n_states] = state;
+  return (StateIndex)array->n_states++;
+}
+
+// Append a new character set to the end of the set array and return its index
+static size_t
+add_set(StateArray* const array, const CharSet* const set)
+{
+  if (array->n_sets == array->sets_capacity) {
+    const size_t capacity =
+      grow_capacity(array->sets_capacity, array->n_sets + 1U);
+
+    CharSet* const new_sets = (CharSet*)mem_realloc(
+      array->allocator, array->sets, capacity * sizeof(CharSet));
+    if (!new_sets) {
+      array->failed = true;
+      return SIZE_MAX;
+    }
 
-  if (new_states) {
-    new_states[new_index] = state;
-    array->states         = new_states;
-    array->n_states       = new_n_states;
+    array->sets          = new_sets;
+    array->sets_capacity = capacity;
   }
 
-  return new_states ? new_index : NO_STATE;
+  array->sets[array->n_sets] = *set;
+  return array->n_sets++;
 }
 
 /* Automata.
@@ -146,7 +372,7 @@ make_automata(const StateIndex start, const StateIndex end)
 static bool
 is_trivial(const StateArray* const states, const Automata nfa)
 {
-  return (states->states[nfa.start].min < REREX_MATCH &&
+  return (is_labeled(&states->states[nfa.start]) &&
           states->states[nfa.start].next1 == nfa.end);
 }
 
@@ -196,7 +422,12 @@ concatenate(StateArray* const states, const Automata a, const Automata b)
   return make_automata(a.start, b.end);
 }
 
-// Alternation (OR) of two NFAs
+/* Alternation (OR) of an NFA and another, which may itself be an alternation.
+
+   The end of `b` becomes the end of the result, so alternating many NFAs from
+   right to left links them all directly to the same end, rather than through
+   a chain of split states that would make finding closures quadratic.
+*/
 static Automata
 alternate(StateArray* const states, const Automata a, const Automata b)
 {
@@ -205,21 +436,54 @@ alternate(StateArray* const states, const Automata a, const Automata b)
   if (is_trivial(states, a)) {
     // Optimization: link a's start directly to b's end (drop a's end)
     states->states[a.start].next1 = b.end;
-    return make_automata(split, b.end);
+  } else {
+    states->states[a.end] = split_state(b.end, NO_STATE);
   }
 
-  if (is_trivial(states, b)) {
-    // Optimization: link b's start directly to a's end (drop b's end)
-    states->states[b.start].next1 = a.end;
-    return make_automata(split, a.end);
-  }
+  return make_automata(split, b.end);
+}
 
-  const StateIndex end = add_state(states, match_state());
+/* Parser stack.
+
+   The parser doesn't recurse, so that very long or deeply nested patterns can
+   be parsed with a constant amount of call stack.  Instead, it keeps the
+   state of every enclosing group, and the alternatives read so far, on an
+   explicit stack of fixed-size items which grows as necessary.
+*/
+typedef struct {
+  RerexAllocator* allocator; ///< Allocator for data
+  char*           data;      ///< Contents of the stack
+  size_t          size;      ///< Size of the contents in bytes
+  size_t          capacity;  ///< Size of data in bytes
+} Stack;
+
+// Push an item of `size` bytes onto the top of the stack
+static RerexStatus
+stack_push(Stack* const stack, const void* const item, const size_t size)
+{
+  if (stack->size + size > stack->capacity) {
+    const size_t capacity = grow_capacity(stack->capacity, stack->size + size);
+    char* const  data =
+      (char*)mem_realloc(stack->allocator, stack->data, capacity);
+    if (!data) {
+      return REREX_NO_MEMORY;
+    }
+
+    stack->data     = data;
+    stack->capacity = capacity;
+  }
 
-  states->states[a.end] = split_state(end, NO_STATE);
-  states->states[b.end] = split_state(end, NO_STATE);
+  memcpy(stack->data + stack->size, item, size);
+  stack->size += size;
+  return REREX_SUCCESS;
+}
 
-  return make_automata(split, end);
+// Pop an item of `size` bytes from the top of the stack
+static void
+stack_pop(Stack* const stack, void* const item, const size_t size)
+{
+  stack->size -= size;
+  memcpy(item, stack->data + stack->size, size);
 }
 
 /* Parser input.
@@ -231,6 +495,7 @@ alternate(StateArray* const states, const Automata a, const Automata b)
 typedef struct {
   const char* const str;
   size_t            offset;
+  RerexFlags        flags;
 } Input;
 
 // Return the next character in the input without consuming it
@@ -255,10 +520,6 @@ eat(Input* const input)
   return input->str[input->offset++];
 }
 
-// Forward declaration for read_expr because it is called recursively
-static RerexStatus
-read_expr(Input* input, StateArray* states, Automata* out);
-
 // DOT      ::= '.'
 // OPERATOR ::= '*' | '+' | '?'
 // SPECIAL  ::= DOT | OPERATOR | '(' | ')' | '[' | ']' | '^' | '{' | '|' | '}'
@@ -277,8 +538,11 @@ read_dot(Input* const input, StateArray* const states, Automata* const out)
   assert(peek(input) == '.');
   eat(input);
 
+  const bool       bytes = input->flags & REREX_BYTES;
+  const Codepoint  min   = bytes ? bmin : cmin;
+  const Codepoint  max   = bytes ? bmax : cmax;
   const StateIndex end   = add_state(states, match_state());
-  const StateIndex start = add_state(states, range_state(cmin, cmax, end));
+  const StateIndex start = add_state(states, range_state(min, max, end));
 
   *out = make_automata(start, end);
 
@@ -361,10 +625,7 @@ read_element(Input* const input, char* const out)
 
 // Range ::= ELEMENT | ELEMENT '-' ELEMENT
 static RerexStatus
-read_range(Input* const      input,
-           StateArray* const states,
-           const bool        negated,
-           Automata* const   out)
+read_range(Input* const input, CharSet* const set)
 {
   RerexStatus st  = REREX_SUCCESS;
   char        min = 0;
@@ -389,21 +650,7 @@ read_range(Input* const      input,
     return REREX_UNORDERED_RANGE;
   }
 
-  const StateIndex end = add_state(states, match_state());
-  if (negated) {
-    const char       emin = (char)(min - 1);
-    const char       emax = (char)(max + 1);
-    const StateIndex low  = add_state(states, range_state(cmin, emin, end));
-    const StateIndex high = add_state(states, range_state(emax, cmax, end));
-    const StateIndex fork = add_state(states, split_state(low, high));
-
-    *out = make_automata(fork, end);
-  } else {
-    const StateIndex start = add_state(states, range_state(min, max, end));
-
-    *out = make_automata(start, end);
-  }
-
+  add_range(set, min, max);
   return st;
 }
 
@@ -413,51 +660,52 @@ read_set(Input* const input, StateArray* const states, Automata* const out)
 {
   RerexStatus st      = REREX_SUCCESS;
   bool        negated = false;
+  CharSet     set     = {{0U, 0U, 0U, 0U}};
 
   if (peek(input) == '^') {
     eat(input);
     negated = true;
   }
 
-  Automata nfa = {NO_STATE, NO_STATE};
-  if ((st = read_range(input, states, negated, &nfa))) {
-    return st;
-  }
-
-  while (peek(input) != ']') {
-    Automata range_nfa = {NO_STATE, NO_STATE};
-    if ((st = read_range(input, states, negated, &range_nfa))) {
+  // Read every range into the set
+  do {
+    if ((st = read_range(input, &set))) {
       return st;
     }
+  } while (peek(input) != ']');
 
-    nfa = alternate(states, nfa, range_nfa);
+  if (negated) {
+    // Complement the set within the range of normal characters or all bytes
+    CharSet all = {{0U, 0U, 0U, 0U}};
+    const bool bytes = input->flags & REREX_BYTES;
+    add_range(&all, bytes ? bmin : cmin, bytes ? bmax : cmax);
+
+    for (unsigned i = 0U; i < 4U; ++i) {
+      set.words[i] = all.words[i] & ~set.words[i];
+    }
+  }
+
+  // Build a single state labeled with the set
+  const size_t index = add_set(states, &set);
+  if (index == SIZE_MAX) {
+    return REREX_NO_MEMORY;
   }
 
-  *out = nfa;
+  const StateIndex end   = add_state(states, match_state());
+  const StateIndex start = add_state(states, class_state(index, end));
+
+  *out = make_automata(start, end);
   return st;
 }
 
 // Atom ::= CHAR | DOT | '(' Expr ')' | '[' Set ']'
+// Groups are handled by read_expr, so this reads any other atom
 static RerexStatus
 read_atom(Input* const input, StateArray* const states, Automata* const out)
 {
   RerexStatus st = REREX_SUCCESS;
   char        c  = peek(input);
 
-  if (c == '(') {
-    eat(input);
-    if ((st = read_expr(input, states, out))) {
-      return st;
-    }
-
-    if (peek(input) != ')') {
-      return REREX_EXPECTED_RPAREN;
-    }
-
-    eat(input);
-    return st;
-  }
-
   if (c == '.') {
     return read_dot(input, states, out);
   }
@@ -486,236 +734,3561 @@ read_atom(Input* const input, StateArray* const states, Automata* const out)
 
 // OPERATOR ::= '*' | '+' | '?'
 // Factor   ::= Atom | Atom OPERATOR
-static RerexStatus
-read_factor(Input* const input, StateArray* const states, Automata* const out)
+static Automata
+read_operator(Input* const input, StateArray* const states, const Automata atom)
 {
-  RerexStatus st       = REREX_SUCCESS;
-  Automata    atom_nfa = {NO_STATE, NO_STATE};
+  const char c = peek(input);
 
-  if (!(st = read_atom(input, states, &atom_nfa))) {
-    const char c = peek(input);
-    if (c == '*') {
-      eat(input);
-      *out = star(states, atom_nfa);
-    } else if (c == '+') {
-      eat(input);
-      *out = plus(states, atom_nfa);
-    } else if (c == '?') {
-      eat(input);
-      *out = question(states, atom_nfa);
-    } else {
-      *out = atom_nfa;
-    }
+  if (c == '*') {
+    eat(input);
+    return star(states, atom);
   }
 
-  return st;
+  if (c == '+') {
+    eat(input);
+    return plus(states, atom);
+  }
+
+  if (c == '?') {
+    eat(input);
+    return question(states, atom);
+  }
+
+  return atom;
 }
 
-// Term ::= Factor | Factor Term
-static RerexStatus
-read_term(Input* const input, StateArray* const states, Automata* const out)
+/* An expression being read, which is saved on the stack while in a group.
+
+   Factors are concatenated as soon as they are read, which only modifies the
+   previous factor, so only the current term and its last factor are needed.
+   Terms are pushed onto the stack, and alternated from right to left when the
+   expression ends, so they all share the end of the last term.
+*/
+typedef struct {
+  size_t   n_terms; ///< Number of terms pushed onto the stack
+  Automata term;    ///< Current term, or null if it has no factors yet
+  Automata last;    ///< Last factor of the current term
+} Group;
+
+// Return a new expression with no terms or factors
+static Group
+new_group(void)
 {
-  RerexStatus st         = REREX_SUCCESS;
-  Automata    factor_nfa = {NO_STATE, NO_STATE};
-  Automata    term_nfa   = {NO_STATE, NO_STATE};
+  const Group group = {0U, {NO_STATE, NO_STATE}, {NO_STATE, NO_STATE}};
+  return group;
+}
 
-  if (!(st = read_factor(input, states, &factor_nfa))) {
-    const char c = peek(input);
-    if (c == '\0' || c == ')' || c == '|') {
-      *out = factor_nfa;
-    } else if (!(st = read_term(input, states, &term_nfa))) {
-      *out = concatenate(states, factor_nfa, term_nfa);
-    }
+// Append a factor to the current term of `group`
+static void
+add_factor(StateArray* const states, Group* const group, const Automata factor)
+{
+  if (group->term.start != NO_STATE) {
+    concatenate(states, group->last, factor);
+    group->term.end = factor.end;
+  } else {
+    group->term = factor;
   }
 
+  group->last = factor;
+}
+
+// Push the current term of `group` onto the stack, and start a new one
+static RerexStatus
+end_term(Stack* const stack, Group* const group)
+{
+  const RerexStatus st = stack_push(stack, &group->term, sizeof(Automata));
+
+  group->term = group->last = make_automata(NO_STATE, NO_STATE);
+  ++group->n_terms;
   return st;
 }
 
+// Pop the terms of an expression from the stack, and return their alternation
+static Automata
+end_expr(StateArray* const states, Stack* const stack, const size_t n_terms)
+{
+  Automata expr = {NO_STATE, NO_STATE};
+  Automata term = {NO_STATE, NO_STATE};
+
+  stack_pop(stack, &expr, sizeof(Automata));
+  for (size_t i = 1U; i < n_terms; ++i) {
+    stack_pop(stack, &term, sizeof(Automata));
+    expr = alternate(states, term, expr);
+  }
+
+  return expr;
+}
+
 // Expr ::= Term | Term '|' Expr
+// Term ::= Factor | Factor Term
 static RerexStatus
-read_expr(Input* const input, StateArray* const states, Automata* const out)
+read_expr(Input* const      input,
+          StateArray* const states,
+          Stack* const      stack,
+          Automata* const   out)
 {
-  RerexStatus st       = REREX_SUCCESS;
-  Automata    term_nfa = {NO_STATE, NO_STATE};
-  Automata    expr_nfa = {NO_STATE, NO_STATE};
+  RerexStatus st    = REREX_SUCCESS;
+  Group       group = new_group();
 
-  if ((st = read_term(input, states, &term_nfa))) {
-    return st;
-  }
+  for (;;) {
+    Automata factor = {NO_STATE, NO_STATE};
 
-  if (peek(input) == '|') {
-    eat(input);
-    if (!(st = read_expr(input, states, &expr_nfa))) {
-      *out = alternate(states, term_nfa, expr_nfa);
+    if (peek(input) == '(') {
+      // Enter a group, saving the expression that contains it
+      eat(input);
+      if ((st = stack_push(stack, &group, sizeof(Group)))) {
+        return st;
+      }
+
+      group = new_group();
+      continue;
     }
-  } else {
-    *out = term_nfa;
-  }
 
-  return st;
+    if ((st = read_atom(input, states, &factor))) {
+      return st;
+    }
+
+    // Add the factor, and end every term, expression, and group it ends
+    for (;;) {
+      add_factor(states, &group, read_operator(input, states, factor));
+
+      const char c = peek(input);
+      if (c != '\0' && c != ')' && c != '|') {
+        break; // Another factor follows
+      }
+
+      if ((st = end_term(stack, &group))) {
+        return st;
+      }
+
+      if (c == '|') {
+        eat(input);
+        break; // Another term follows
+      }
+
+      factor = end_expr(states, stack, group.n_terms);
+      if (!stack->size) {
+        *out = factor; // End of the top-level expression
+        return st;
+      }
+
+      if (c != ')') {
+        return REREX_EXPECTED_RPAREN;
+      }
+
+      // Leave the group, which is a factor in the enclosing expression
+      eat(input);
+      stack_pop(stack, &group, sizeof(Group));
+    }
+  }
 }
 
-/* Pattern.
+/* State counting.
 
-   A pattern is simply an array of states and an index to the start state.  The
-   end state(s) are known because they have type REREX_MATCH.  A pattern is
-   immutable after construction, the matcher does not modify it.
+   The number of states that parsing adds can be counted in advance by
+   scanning the pattern, so the state array can be allocated once at exactly
+   the right size.  Every atom adds two states, every operator adds one (or
+   two for star), and every alternative after the first adds one, regardless
+   of the structure of the expression, so this is a simple linear scan that
+   doesn't check the syntax.  The count is only used as a capacity, and the
+   array still grows if necessary.
 */
-struct RerexPatternImpl {
-  StateArray states;
-  StateIndex start;
-};
 
-void
-rerex_free_pattern(RerexPattern* const regexp)
-{
-  free(regexp->states.states);
-  free(regexp);
-}
+typedef struct {
+  size_t n_states; // Number of states
+  size_t n_sets;   // Number of character sets
+} StateCount;
 
-RerexStatus
-rerex_compile(const char* const    pattern,
-              size_t* const        end,
-              RerexPattern** const out)
+// Count the states of an atom other than a group
+static void
+count_atom(Input* const input, StateCount* const count)
 {
-  Input      input  = {pattern, 0};
-  Automata   nfa    = {NO_STATE, NO_STATE};
-  StateArray states = {NULL, 0};
+  const char c = peek(input);
 
-  // Add null state so that no actual state has NO_STATE as an ID
-  add_state(&states, split_state(NO_STATE, NO_STATE));
+  if (c == '[') {
+    // Skip to the closing bracket, which can only be escaped in a set
+    eat(input);
+    while (peek(input) && peek(input) != ']') {
+      if (eat(input) == '\\' && peek(input) == ']') {
+        eat(input);
+      }
+    }
 
-  RerexStatus st = states.states ? REREX_SUCCESS : REREX_NO_MEMORY;
-  if (!st) {
-    // Read the expression, building the NFA and its states array
-    st   = read_expr(&input, &states, &nfa);
-    *end = input.offset;
+    ++count->n_sets;
+  } else if (c == '\\' && peekahead(input)) {
+    eat(input);
   }
 
-  // "Return" a newly allocated pattern
-  if (!st && (*out = (RerexPattern*)malloc(sizeof(RerexPattern)))) {
-    (*out)->states = states;
-    (*out)->start  = nfa.start;
-    return REREX_SUCCESS;
+  if (peek(input)) {
+    eat(input);
   }
 
-  free(states.states);
-  return st;
+  count->n_states += 2U;
 }
 
-/* Matcher */
+// Count the states of an expression, which ends like read_expr()
+static void
+count_expr(Input* const input, StateCount* const count)
+{
+  size_t depth = 0U;
+
+  for (char c = peek(input); c && (c != ')' || depth); c = peek(input)) {
+    if (c == '(' || c == ')') {
+      eat(input);
+      depth = (c == '(') ? depth + 1U : depth - 1U;
+    } else if (c == '*' || c == '+' || c == '?' || c == '|') {
+      eat(input);
+      count->n_states += (c == '*') ? 2U : 1U;
+    } else {
+      count_atom(input, count);
+    }
+  }
+}
 
 typedef struct {
   StateIndex* indices;   // Array of state indices
   size_t      n_indices; // Number of elements in indices
 } IndexList;
 
-/* Matcher.
+/* Epsilon-free NFA.
+
+   The NFA built by the parser has split states with epsilon transitions,
+   which are slow to follow while matching, so after parsing it is converted
+   to an equivalent NFA with only labeled states, called positions.  Each
+   position has a list of follow positions, which are the labeled states
+   reachable from its successor by epsilon transitions, and there is a similar
+   list of the positions reachable from the start state.  Every match state is
+   replaced by a single final position, which has an empty label.  Since no
+   arcs need to be followed to find successors, the matcher only ever touches
+   positions that may actually match the next character.
+*/
 
-   The matcher tracks active states by keeping two lists of indices: one for
-   the current iteration, and one for the next.  A separate array, keyed by
-   state index, stores the number of the last iteration the state was entered
-   in.  This makes it simple and fast to check if a state has already been
-   entered in the current iteration, avoiding the need to search the active
-   list for every entered state.
+typedef struct {
+  Codepoint  min;      ///< Inclusive minimum label, or a special StateType
+  Codepoint  max;      ///< Inclusive maximum label, or set index if a class
+  StateIndex follow;   ///< Offset of the first follow position
+  StateIndex n_follow; ///< Number of follow positions
+} Position;
+
+// Index of the final position, which is entered when the pattern matches
+static const StateIndex FINAL = 0U;
+
+// Sentinel value for a state that has no position
+static const StateIndex NO_POSITION = UINT32_MAX;
+
+/* Position labels.
+
+   Every step tests the label of every active position, but only needs the
+   follows of the positions that match, so labels are also stored in a
+   separate compact array.  A label is the range of bytes a position may match,
+   which is exact for ranges, and the bounds of the set for character classes,
+   which must then be checked against the set.  A position that never matches,
+   like the final position, has an empty range.
 */
-struct RerexMatcherImpl {
-  const RerexPattern* regexp;      // Pattern to match against
-  IndexList           active[2];   // Two lists of active states
+typedef struct {
+  uint8_t min; ///< Inclusive minimum byte
+  uint8_t max; ///< Inclusive maximum byte, less than min if empty
+} Label;
+
+/* Complete DFA.
+
+   A complete DFA is built ahead of time from the NFA by subset construction,
+   so matching is a single lookup in a dense transition table for every byte.
+*/
+
+// The index of a DFA state, where zero is reserved to mean "unknown"
+typedef uint32_t DfaIndex;
+
+typedef struct {
+  DfaIndex* next;      ///< Transition table, one row per state
+  bool*     accepting; ///< Whether each state is accepting
+  size_t    n_dstates; ///< Number of states, including unused zero
+  DfaIndex  start;     ///< Start state
+  DfaIndex  dead;      ///< State with no transitions to any other state
+} DfaTable;
+
+/* Bit-parallel NFA.
+
+   When a pattern has few enough positions, a set of positions can be
+   represented by a few machine words with one bit per position, so the set
+   of active positions doesn't need to be stored in memory at all.  A step is
+   then a few bitwise operations: the active set is masked with the set of
+   positions whose label contains the input byte, and the follow sets of the
+   remaining positions are combined to get the next active set.
+*/
+
+typedef uint64_t Word;
+
+// Maximum number of words in a set, so patterns have up to 256 positions
+#define MAX_WORDS 4U
+
+typedef struct {
+  Word*  masks;            ///< Positions that accept each byte, 256 sets
+  Word*  follows;          ///< Follow set of every position
+  Word   start[MAX_WORDS]; ///< Start positions
+  size_t n_words;          ///< Number of words in a set, or zero if too big
+} BitTable;
+
+/* Pattern.
+
+   A pattern is simply an array of positions, and an array of their follow
+   lists which also contains the start list.  The final position is always
+   the first.  A pattern is immutable after construction, the matcher does
+   not modify it.
+*/
+struct RerexPatternImpl {
+  RerexAllocator* allocator;    ///< Allocator for everything in the pattern
+  Position*       positions;    ///< Positions, starting with the final position
+  Label*          labels;       ///< Label of every position
+  size_t          n_positions;  ///< Number of positions
+  CharSet*        sets;         ///< Labels of character class positions
+  char*           prefix;       ///< Literal that every match starts with
+  size_t          prefix_len;   ///< Length of prefix in bytes
+  char*           suffix;       ///< Literal that every match ends with
+  size_t          suffix_len;   ///< Length of suffix in bytes
+  size_t          min_length;   ///< Length of the shortest match
+  size_t          max_length;   ///< Length of the longest match, or SIZE_MAX
+  StateIndex*     follows;      ///< Follow lists of all positions
+  size_t          start;        ///< Offset of the first start position
+  size_t          n_start;      ///< Number of start positions
+  DfaTable        dfa;          ///< Complete DFA, if compiled
+  BitTable        bits;         ///< Bit-parallel tables, if small enough
+  size_t          n_classes;    ///< Number of byte classes
+  uint8_t         classes[256]; ///< Byte class of every byte
+  RerexEngine     engine;       ///< Engine used for matching
+  const char*     reason;       ///< Why the engine was chosen
+};
+
+// Return whether the label of position `p` contains `c`
+static bool
+accepts(const RerexPattern* const pattern,
+        const Position* const     p,
+        const char                c)
+{
+  const Codepoint byte = (uint8_t)c;
+
+  return (p->min <= byte && byte <= p->max) ||
+         (p->min == REREX_CLASS && set_contains(&pattern->sets[p->max], c));
+}
+
+// Return the compact label of position `p`
+static Label
+label_of(const RerexPattern* const pattern, const Position* const p)
+{
+  Label label = {UINT8_MAX, 0U};
+
+  if (p->min == REREX_CLASS) {
+    const CharSet* const set = &pattern->sets[p->max];
+    for (unsigned c = 0U; c < 256U; ++c) {
+      if (set_contains(set, (char)c)) {
+        label.min = (uint8_t)(c < label.min ? c : label.min);
+        label.max = (uint8_t)c;
+      }
+    }
+  } else if (p->min <= p->max) {
+    label.min = (uint8_t)p->min;
+    label.max = (uint8_t)p->max;
+  }
+
+  return label;
+}
+
+/* Position construction.
+
+   Positions are numbered in the order they are discovered while computing
+   the closures of the start state and then every position in turn, so only
+   states that are actually reachable become positions.
+*/
+typedef struct {
+  RerexAllocator*   allocator;   ///< Allocator for temporary arrays
+  const StateArray* states;      ///< Parsed NFA states
+  size_t*           marks;       ///< Last closure every state was visited in
+  StateIndex*       position_of; ///< Position of every state, or NO_POSITION
+  StateIndex*       state_of;    ///< State of every position
+  Position*         positions;   ///< Positions found so far
+  size_t            n_positions; ///< Number of positions found so far
+  StateIndex*       closure;     ///< States in the current closure
+  size_t            n_closure;   ///< Number of states in current closure
+  StateIndex*       stack;       ///< States left to visit in the closure
+  StateIndex*       follows;     ///< Follow lists of all positions
+  size_t            n_follows;   ///< Number of indices in follows
+  size_t            capacity;    ///< Number of indices follows can hold
+} PositionBuilder;
+
+/* Add `s` and every state reachable from it by epsilon to the closure.
+
+   This is a depth-first search that visits the first arc of a split before
+   the second, so labeled states are added in priority order.  It uses an
+   explicit stack rather than recursion, since deeply nested patterns have
+   long chains of split states.  Every split is expanded at most once and
+   pushes two states, so the stack never needs more than twice the number of
+   states.
+*/
+static void
+collect_closure(PositionBuilder* const builder,
+                const size_t           mark,
+                const StateIndex       s)
+{
+  StateIndex* const stack   = builder->stack;
+  size_t            n_stack = 0U;
+
+  stack[n_stack++] = s;
+  while (n_stack) {
+    const StateIndex t = stack[--n_stack];
+    if (t && builder->marks[t] != mark) {
+      builder->marks[t] = mark;
+
+      const State* const state = &builder->states->states[t];
+      if (state->min == REREX_SPLIT) {
+        stack[n_stack++] = state->next2;
+        stack[n_stack++] = state->next1;
+      } else {
+        builder->closure[builder->n_closure++] = t;
+      }
+    }
+  }
+}
+
+// Return the position for labeled state `s`, adding it if necessary
+static StateIndex
+get_position(PositionBuilder* const builder, const StateIndex s)
+{
+  if (builder->position_of[s] == NO_POSITION) {
+    const State* const state = &builder->states->states[s];
+    Position* const    p     = &builder->positions[builder->n_positions];
+
+    p->min = state->min;
+    p->max = state->max;
+
+    builder->state_of[builder->n_positions] = s;
+    builder->position_of[s] = (StateIndex)builder->n_positions++;
+  }
+
+  return builder->position_of[s];
+}
+
+// Append the positions in the closure of state `s` to the follow lists
+static RerexStatus
+append_closure(PositionBuilder* const builder,
+               const size_t           mark,
+               const StateIndex       s)
+{
+  builder->n_closure = 0U;
+  collect_closure(builder, mark, s);
+
+  // Grow the follow lists to have room for every state in the closure
+  const size_t size = builder->n_follows + builder->n_closure;
+  if (size >= UINT32_MAX) {
+    return REREX_NO_MEMORY; // Too many for 32-bit offsets
+  }
+
+  if (size > builder->capacity || !builder->follows) {
+    const size_t capacity = grow_capacity(builder->capacity, size);
+
+    StateIndex* const new_follows = (StateIndex*)mem_realloc(
+      builder->allocator, builder->follows, capacity * sizeof(StateIndex));
+    if (!new_follows) {
+      return REREX_NO_MEMORY;
+    }
+
+    builder->follows  = new_follows;
+    builder->capacity = capacity;
+  }
+
+  StateIndex* const follows = builder->follows;
+
+  // Append the position of every state, but the final position only once
+  bool final = false;
+  for (size_t i = 0U; i < builder->n_closure; ++i) {
+    const StateIndex c        = builder->closure[i];
+    const bool       is_final = builder->states->states[c].min == REREX_MATCH;
+
+    if (!is_final || !final) {
+      follows[builder->n_follows++] = is_final ? FINAL
+                                               : get_position(builder, c);
+      final = final || is_final;
+    }
+  }
+
+  return REREX_SUCCESS;
+}
+
+// Build the positions of a pattern from the parsed NFA
+static RerexStatus
+build_positions(RerexPattern* const     pattern,
+                const StateArray* const states,
+                const StateIndex        start)
+{
+  RerexAllocator* const allocator = pattern->allocator;
+  const size_t          n_states  = states->n_states;
+  PositionBuilder       builder   = {
+    allocator,
+    states,
+    (size_t*)mem_calloc(allocator, n_states, sizeof(size_t)),
+    (StateIndex*)mem_calloc(allocator, n_states, sizeof(StateIndex)),
+    (StateIndex*)mem_calloc(allocator, n_states, sizeof(StateIndex)),
+    (Position*)mem_calloc(allocator, n_states, sizeof(Position)),
+    1U,
+    (StateIndex*)mem_calloc(allocator, n_states, sizeof(StateIndex)),
+    0U,
+    (StateIndex*)mem_calloc(allocator, 2U * n_states, sizeof(StateIndex)),
+    NULL,
+    0U,
+    0U,
+  };
+
+  RerexStatus st = REREX_NO_MEMORY;
+  if (builder.marks && builder.position_of && builder.state_of &&
+      builder.positions && builder.closure && builder.stack) {
+    const Position final_position = {REREX_MATCH, 0, 0U, 0U};
+
+    builder.positions[FINAL] = final_position;
+    for (size_t i = 0U; i < n_states; ++i) {
+      builder.marks[i]       = SIZE_MAX;
+      builder.position_of[i] = NO_POSITION;
+    }
+
+    // Compute the start list, then the follow list of every position
+    st               = append_closure(&builder, 0U, start);
+    pattern->start   = 0U;
+    pattern->n_start = builder.n_follows;
+    for (size_t p = 1U; !st && p < builder.n_positions; ++p) {
+      const StateIndex s      = builder.state_of[p];
+      const size_t     offset = builder.n_follows;
+
+      st = append_closure(&builder, p, states->states[s].next1);
+
+      builder.positions[p].follow   = (StateIndex)offset;
+      builder.positions[p].n_follow = (StateIndex)(builder.n_follows - offset);
+    }
+  }
+
+  if (!st) {
+    // Move positions and follows to the pattern, shrinking them to fit
+    const size_t positions_size = builder.n_positions * sizeof(Position);
+    const size_t follows_size   = builder.n_follows * sizeof(StateIndex);
+
+    pattern->positions =
+      (Position*)mem_shrink(allocator, builder.positions, positions_size);
+    pattern->follows =
+      (StateIndex*)mem_shrink(allocator, builder.follows, follows_size);
+    pattern->n_positions = builder.n_positions;
+    builder.positions    = NULL;
+    builder.follows      = NULL;
+  }
+
+  mem_free(allocator, builder.follows);
+  mem_free(allocator, builder.stack);
+  mem_free(allocator, builder.closure);
+  mem_free(allocator, builder.positions);
+  mem_free(allocator, builder.state_of);
+  mem_free(allocator, builder.position_of);
+  mem_free(allocator, builder.marks);
+  return st;
+}
+
+// Build the compact label of every position
+static RerexStatus
+build_labels(RerexPattern* const pattern)
+{
+  const size_t n_positions = pattern->n_positions;
+
+  pattern->labels =
+    (Label*)mem_calloc(pattern->allocator, n_positions, sizeof(Label));
+  if (!pattern->labels) {
+    return REREX_NO_MEMORY;
+  }
+
+  for (size_t p = 0U; p < n_positions; ++p) {
+    pattern->labels[p] = label_of(pattern, &pattern->positions[p]);
+  }
+
+  return REREX_SUCCESS;
+}
+
+/* Byte classes.
+
+   A byte class is a range of bytes that every arc label either contains
+   entirely, or not at all.  Bytes in the same class are indistinguishable to
+   the automaton, so DFA transitions are keyed by class rather than by byte,
+   which keeps transition tables small.
+*/
+static void
+compute_classes(RerexPattern* const pattern)
+{
+  bool boundaries[257] = {false};
+
+  // Mark the start of every label and the byte after its end as boundaries
+  for (size_t p = 0U; p < pattern->n_positions; ++p) {
+    const Position* const position = &pattern->positions[p];
+    if (position->min == REREX_CLASS) {
+      const CharSet* const set = &pattern->sets[position->max];
+      for (unsigned c = 1U; c < 256U; ++c) {
+        boundaries[c] = boundaries[c] || (set_contains(set, (char)c) !=
+                                          set_contains(set, (char)(c - 1U)));
+      }
+    } else if (position->min <= position->max) {
+      boundaries[position->min]     = true;
+      boundaries[position->max + 1] = true;
+    }
+  }
+
+  // Number classes in order, starting a new one at every boundary
+  size_t n_classes = 0U;
+  for (unsigned c = 0U; c < 256U; ++c) {
+    n_classes += (c == 0U || boundaries[c]) ? 1U : 0U;
+    pattern->classes[c] = (uint8_t)(n_classes - 1U);
+  }
+
+  pattern->n_classes = n_classes;
+}
+
+// Set bit `p` in the set `words`
+static void
+set_bit(Word* const words, const size_t p)
+{
+  words[p / 64U] |= (Word)1U << (p % 64U);
+}
+
+// Build the bit-parallel tables of a pattern if it's small enough
+static RerexStatus
+build_bits(RerexPattern* const pattern)
+{
+  BitTable* const bits    = &pattern->bits;
+  const size_t    n_words = (pattern->n_positions + 63U) / 64U;
+  if (n_words > MAX_WORDS) {
+    return REREX_SUCCESS;
+  }
+
+  RerexAllocator* const allocator = pattern->allocator;
+  const size_t          n_follows = pattern->n_positions * n_words;
+
+  bits->masks   = (Word*)mem_calloc(allocator, 256U * n_words, sizeof(Word));
+  bits->follows = (Word*)mem_calloc(allocator, n_follows, sizeof(Word));
+  if (!bits->masks || !bits->follows) {
+    return REREX_NO_MEMORY;
+  }
+
+  // Set the bit for each position in the mask of every byte in its label
+  for (size_t p = 0U; p < pattern->n_positions; ++p) {
+    const Position* const position = &pattern->positions[p];
+    for (unsigned c = 0U; c < 256U; ++c) {
+      if (accepts(pattern, position, (char)c)) {
+        set_bit(bits->masks + (c * n_words), p);
+      }
+    }
+
+    for (size_t i = 0U; i < position->n_follow; ++i) {
+      const StateIndex f = pattern->follows[position->follow + i];
+
+      set_bit(bits->follows + (p * n_words), f);
+    }
+  }
+
+  for (size_t i = 0U; i < pattern->n_start; ++i) {
+    set_bit(bits->start, pattern->follows[pattern->start + i]);
+  }
+
+  bits->n_words = n_words;
+  return REREX_SUCCESS;
+}
+
+/* Literals.
+
+   Many patterns start or end with a fixed string, which every matching string
+   must also start or end with.  These are found by walking the automaton
+   forwards from the start, or backwards from the final position, for as long
+   as every position in the current set is labeled with the same single
+   character.  Matching can then reject strings without these literals before
+   running the automaton at all.  Neither literal can be longer than the
+   shortest match, which visits every position at most once, so the number of
+   positions bounds the length of both.
+*/
+typedef struct {
+  const RerexPattern* pattern;     ///< Pattern to find literals in
+  size_t*             marks;       ///< Last step every position was added in
+  bool*               starts;      ///< Whether each position is a start
+  IndexList           sets[2];     ///< Current and next set of positions
+  size_t*             pred_starts; ///< Offset of predecessors of each position
+  StateIndex*         preds;       ///< Predecessors of all positions
+  char*               literal;     ///< Buffer for the literal being found
+} LiteralFinder;
+
+// Set `c` to the only character in the label of `p` and return true, if any
+static bool
+single_char(const RerexPattern* const pattern,
+            const Position* const     p,
+            char* const               c)
+{
+  if (p->min == REREX_CLASS) {
+    const CharSet* const set   = &pattern->sets[p->max];
+    unsigned             count = 0U;
+    for (unsigned b = 0U; b < 256U; ++b) {
+      if (set_contains(set, (char)b)) {
+        *c = (char)b;
+        ++count;
+      }
+    }
+
+    return count == 1U;
+  }
+
+  *c = (char)p->min;
+  return p->min == p->max;
+}
+
+// Return the single character that labels every position in `set`, or zero
+static char
+common_char(const RerexPattern* const pattern, const IndexList* const set)
+{
+  char common = 0;
+
+  for (size_t i = 0U; i < set->n_indices; ++i) {
+    const Position* const p = &pattern->positions[set->indices[i]];
+    char                  c = 0;
+    if (!single_char(pattern, p, &c) || (i && c != common)) {
+      return 0;
+    }
+
+    common = c;
+  }
+
+  return common;
+}
+
+// Add `p` to the next set of positions if it hasn't been added in this step
+static void
+add_to_next(LiteralFinder* const finder, const size_t step, const StateIndex p)
+{
+  IndexList* const next = &finder->sets[1];
+
+  if (finder->marks[p] != step) {
+    finder->marks[p]                 = step;
+    next->indices[next->n_indices++] = p;
+  }
+}
+
+// Make the next set of positions current and clear the next set
+static void
+swap_sets(LiteralFinder* const finder)
+{
+  const IndexList current = finder->sets[0];
+
+  finder->sets[0]           = finder->sets[1];
+  finder->sets[1]           = current;
+  finder->sets[1].n_indices = 0U;
+}
+
+// Return a copy of the first `len` characters of `literal` for `pattern`
+static char*
+copy_literal(const RerexPattern* const pattern,
+             const char* const         literal,
+             const size_t              len)
+{
+  char* const copy = (char*)mem_calloc(pattern->allocator, len + 1U, 1U);
+  if (copy && len) {
+    memcpy(copy, literal, len);
+  }
+
+  return copy;
+}
+
+// Find the literal that every match starts with, by walking forwards
+static size_t
+find_prefix(LiteralFinder* const finder)
+{
+  const RerexPattern* const pattern = finder->pattern;
+  size_t                    len     = 0U;
+
+  // Start with the start positions (if the final is one, it fails right away)
+  for (size_t i = 0U; i < pattern->n_start; ++i) {
+    add_to_next(finder, 0U, pattern->follows[pattern->start + i]);
+  }
+
+  swap_sets(finder);
+  for (char c = 0; len < pattern->n_positions &&
+                   (c = common_char(pattern, &finder->sets[0]));
+       ++len) {
+    finder->literal[len] = c;
+
+    // Replace the current set with the union of the follows of its positions
+    for (size_t i = 0U; i < finder->sets[0].n_indices; ++i) {
+      const Position* const p = &pattern->positions[finder->sets[0].indices[i]];
+      for (size_t f = 0U; f < p->n_follow; ++f) {
+        add_to_next(finder, len + 1U, pattern->follows[p->follow + f]);
+      }
+    }
+
+    swap_sets(finder);
+  }
+
+  return len;
+}
+
+// Build the predecessor lists of every position from the follow lists
+static void
+build_preds(LiteralFinder* const finder)
+{
+  const RerexPattern* const pattern = finder->pattern;
+  const size_t              n       = pattern->n_positions;
+
+  // Count the predecessors of every position, then convert counts to offsets
+  for (size_t p = 0U; p < n; ++p) {
+    const Position* const position = &pattern->positions[p];
+    for (size_t f = 0U; f < position->n_follow; ++f) {
+      ++finder->pred_starts[pattern->follows[position->follow + f] + 1U];
+    }
+  }
+
+  for (size_t p = 0U; p < n; ++p) {
+    finder->pred_starts[p + 1U] += finder->pred_starts[p];
+  }
+
+  // Fill in predecessors, using marks to count how many each position has
+  for (size_t p = 0U; p < n; ++p) {
+    finder->marks[p] = 0U;
+  }
+
+  for (size_t p = 0U; p < n; ++p) {
+    const Position* const position = &pattern->positions[p];
+    for (size_t f = 0U; f < position->n_follow; ++f) {
+      const StateIndex q = pattern->follows[position->follow + f];
+
+      finder->preds[finder->pred_starts[q] + finder->marks[q]++] =
+        (StateIndex)p;
+    }
+  }
+
+  for (size_t p = 0U; p < n; ++p) {
+    finder->marks[p] = SIZE_MAX;
+  }
+}
+
+// Add the predecessors of position `p` to the next set
+static void
+add_preds(LiteralFinder* const finder, const size_t step, const StateIndex p)
+{
+  for (size_t i = finder->pred_starts[p]; i < finder->pred_starts[p + 1U];
+       ++i) {
+    add_to_next(finder, step, finder->preds[i]);
+  }
+}
+
+// Find the literal that every match ends with, by walking backwards
+static size_t
+find_suffix(LiteralFinder* const finder)
+{
+  const RerexPattern* const pattern = finder->pattern;
+  const size_t              n       = pattern->n_positions;
+  const StateIndex* const   start   = pattern->follows + pattern->start;
+  size_t                    len     = 0U;
+
+  // Start with the positions before the final position, if it isn't a start
+  for (size_t i = 0U; i < pattern->n_start; ++i) {
+    if (start[i] == FINAL) {
+      return 0U;
+    }
+
+    finder->starts[start[i]] = true;
+  }
+
+  add_preds(finder, 1U, FINAL);
+  swap_sets(finder);
+  for (char c = 0; len < n && (c = common_char(pattern, &finder->sets[0]));) {
+    finder->literal[n - ++len] = c;
+
+    // Replace the current set with its predecessors, unless one is a start
+    for (size_t i = 0U; i < finder->sets[0].n_indices; ++i) {
+      const StateIndex p = finder->sets[0].indices[i];
+      if (finder->starts[p]) {
+        return len;
+      }
+
+      add_preds(finder, len + 1U, p);
+    }
+
+    swap_sets(finder);
+  }
+
+  return len;
+}
+
+// Find the prefix and suffix literals of a pattern
+static RerexStatus
+find_literals(RerexPattern* const pattern)
+{
+  RerexAllocator* const allocator = pattern->allocator;
+  const size_t          n         = pattern->n_positions;
+  size_t                n_arcs    = 0U;
+  for (size_t p = 0U; p < n; ++p) {
+    n_arcs += pattern->positions[p].n_follow;
+  }
+
+  LiteralFinder finder = {
+    pattern,
+    (size_t*)mem_calloc(allocator, n, sizeof(size_t)),
+    (bool*)mem_calloc(allocator, n, sizeof(bool)),
+    {{(StateIndex*)mem_calloc(allocator, n, sizeof(StateIndex)), 0U},
+     {(StateIndex*)mem_calloc(allocator, n, sizeof(StateIndex)), 0U}},
+    (size_t*)mem_calloc(allocator, n + 1U, sizeof(size_t)),
+    (StateIndex*)mem_calloc(
+      allocator, n_arcs ? n_arcs : 1U, sizeof(StateIndex)),
+    (char*)mem_calloc(allocator, n, 1U),
+  };
+
+  RerexStatus st = REREX_NO_MEMORY;
+  if (finder.marks && finder.starts && finder.sets[0].indices &&
+      finder.sets[1].indices && finder.pred_starts && finder.preds &&
+      finder.literal) {
+    for (size_t p = 0U; p < n; ++p) {
+      finder.marks[p] = SIZE_MAX;
+    }
+
+    size_t len = find_prefix(&finder);
+    pattern->prefix     = copy_literal(pattern, finder.literal, len);
+    pattern->prefix_len = len;
+
+    build_preds(&finder);
+    finder.sets[0].n_indices = 0U;
+    finder.sets[1].n_indices = 0U;
+
+    len                 = find_suffix(&finder);
+    pattern->suffix     = copy_literal(pattern, finder.literal + n - len, len);
+    pattern->suffix_len = len;
+
+    st = (pattern->prefix && pattern->suffix) ? REREX_SUCCESS
+                                              : REREX_NO_MEMORY;
+  }
+
+  mem_free(allocator, finder.literal);
+  mem_free(allocator, finder.preds);
+  mem_free(allocator, finder.pred_starts);
+  mem_free(allocator, finder.sets[1].indices);
+  mem_free(allocator, finder.sets[0].indices);
+  mem_free(allocator, finder.starts);
+  mem_free(allocator, finder.marks);
+  return st;
+}
+
+const char*
+rerex_prefix(const RerexPattern* const pattern)
+{
+  return pattern->prefix;
+}
+
+const char*
+rerex_suffix(const RerexPattern* const pattern)
+{
+  return pattern->suffix;
+}
+
+/* Length bounds.
+
+   Every position consumes exactly one character, so the shortest match is the
+   number of positions on the shortest path from a start position to the final
+   position, and the longest match is the number on the longest path.  Every
+   position is reachable from the start and can reach the final position, so
+   if there is any cycle, there is no longest match.  Otherwise, the positions
+   form a DAG, and the longest path is found by visiting them in topological
+   order.  Matching can then reject strings with an impossible length without
+   looking at their contents.
+*/
+
+// Return the length of the shortest path to the final position
+static size_t
+find_min_length(RerexPattern* const pattern,
+                size_t* const       lengths,
+                StateIndex* const   queue)
+{
+  const size_t n      = pattern->n_positions;
+  size_t       n_done = 0U;
+  size_t       n_todo = 0U;
+
+  for (size_t p = 0U; p < n; ++p) {
+    lengths[p] = SIZE_MAX;
+  }
+
+  for (size_t i = 0U; i < pattern->n_start; ++i) {
+    const StateIndex p = pattern->follows[pattern->start + i];
+    lengths[p]         = 0U;
+    queue[n_todo++]    = p;
+  }
+
+  while (n_done < n_todo) {
+    const Position* const p   = &pattern->positions[queue[n_done]];
+    const size_t          len = lengths[queue[n_done++]] + 1U;
+    for (size_t i = 0U; i < p->n_follow; ++i) {
+      const StateIndex f = pattern->follows[p->follow + i];
+      if (lengths[f] == SIZE_MAX) {
+        lengths[f]      = len;
+        queue[n_todo++] = f;
+      }
+    }
+  }
+
+  return lengths[FINAL];
+}
+
+// Return the length of the longest path to the final position, or SIZE_MAX
+static size_t
+find_max_length(RerexPattern* const pattern,
+                size_t* const       lengths,
+                StateIndex* const   queue)
+{
+  const size_t n      = pattern->n_positions;
+  size_t       n_done = 0U;
+  size_t       n_todo = 0U;
+
+  // Count the predecessors of every position
+  size_t* const n_preds = lengths + n;
+  memset(lengths, 0, 2U * n * sizeof(size_t));
+  for (size_t i = 0U; i < n; ++i) {
+    const Position* const p = &pattern->positions[i];
+    for (size_t j = 0U; j < p->n_follow; ++j) {
+      ++n_preds[pattern->follows[p->follow + j]];
+    }
+  }
+
+  // Start with the positions that have no predecessors
+  for (size_t p = 0U; p < n; ++p) {
+    if (!n_preds[p]) {
+      queue[n_todo++] = (StateIndex)p;
+    }
+  }
+
+  // Visit positions after all of their predecessors, maximizing lengths
+  while (n_done < n_todo) {
+    const Position* const p   = &pattern->positions[queue[n_done]];
+    const size_t          len = lengths[queue[n_done++]] + 1U;
+    for (size_t i = 0U; i < p->n_follow; ++i) {
+      const StateIndex f = pattern->follows[p->follow + i];
+      lengths[f]         = len > lengths[f] ? len : lengths[f];
+      if (!--n_preds[f]) {
+        queue[n_todo++] = f;
+      }
+    }
+  }
+
+  // Any positions that were never visited are on a cycle
+  return n_done < n ? SIZE_MAX : lengths[FINAL];
+}
+
+static RerexStatus
+find_lengths(RerexPattern* const pattern)
+{
+  RerexAllocator* const allocator = pattern->allocator;
+  const size_t          n         = pattern->n_positions;
+
+  size_t* const lengths =
+    (size_t*)mem_calloc(allocator, 2U * n, sizeof(size_t));
+  StateIndex* const queue =
+    (StateIndex*)mem_calloc(allocator, n, sizeof(StateIndex));
+
+  RerexStatus st = REREX_NO_MEMORY;
+  if (lengths && queue) {
+    pattern->min_length = find_min_length(pattern, lengths, queue);
+    pattern->max_length = find_max_length(pattern, lengths, queue);
+    st                  = REREX_SUCCESS;
+  }
+
+  mem_free(allocator, queue);
+  mem_free(allocator, lengths);
+  return st;
+}
+
+size_t
+rerex_min_length(const RerexPattern* const pattern)
+{
+  return pattern->min_length;
+}
+
+size_t
+rerex_max_length(const RerexPattern* const pattern)
+{
+  return pattern->max_length;
+}
+
+RerexEngine
+rerex_engine(const RerexPattern* const pattern)
+{
+  return pattern->engine;
+}
+
+const char*
+rerex_engine_reason(const RerexPattern* const pattern)
+{
+  return pattern->reason;
+}
+
+// Free everything owned by a pattern, but not the pattern itself
+static void
+clear_pattern(RerexPattern* const regexp)
+{
+  RerexAllocator* const allocator = regexp->allocator;
+
+  mem_free(allocator, regexp->suffix);
+  mem_free(allocator, regexp->prefix);
+  mem_free(allocator, regexp->bits.follows);
+  mem_free(allocator, regexp->bits.masks);
+  mem_free(allocator, regexp->dfa.accepting);
+  mem_free(allocator, regexp->dfa.next);
+  mem_free(allocator, regexp->follows);
+  mem_free(allocator, regexp->sets);
+  mem_free(allocator, regexp->labels);
+  mem_free(allocator, regexp->positions);
+}
+
+void
+rerex_free_pattern(RerexPattern* const regexp)
+{
+  clear_pattern(regexp);
+  mem_free(regexp->allocator, regexp);
+}
+
+// Forward declaration for choosing an engine, which builds DFAs with a matcher
+static RerexStatus
+plan_engine(RerexPattern* pattern, RerexFlags flags);
+
+RerexStatus
+rerex_compile(const char* const    pattern,
+              size_t* const        end,
+              RerexPattern** const out)
+{
+  return rerex_compile_flags(pattern, 0U, end, out);
+}
+
+RerexStatus
+rerex_compile_flags(const char* const    pattern,
+                    const RerexFlags     flags,
+                    size_t* const        end,
+                    RerexPattern** const out)
+{
+  return rerex_compile_alloc(NULL, pattern, flags, end, out);
+}
+
+RerexStatus
+rerex_compile_alloc(RerexAllocator* const allocator,
+                    const char* const     pattern,
+                    const RerexFlags      flags,
+                    size_t* const         end,
+                    RerexPattern** const  out)
+{
+  RerexAllocator* const alloc  = get_allocator(allocator);
+  Input                 input  = {pattern, 0, flags};
+  Automata              nfa    = {NO_STATE, NO_STATE};
+  StateArray            states = {NULL, 0U, 0U, NULL, 0U, 0U, alloc, false};
+  Stack                 stack  = {alloc, NULL, 0U, 0U};
+
+  if (flags & REREX_EXACT_SIZE) {
+    // Count the states first, including the null state, to allocate once
+    Input      scanner = {pattern, 0, flags};
+    StateCount count   = {1U, 0U};
+
+    count_expr(&scanner, &count);
+    reserve_states(&states, count.n_states, count.n_sets);
+  }
+
+  // Add null state so that no actual state has NO_STATE as an ID
+  add_state(&states, split_state(NO_STATE, NO_STATE));
+
+  RerexStatus st = states.failed ? REREX_NO_MEMORY : REREX_SUCCESS;
+  if (!st) {
+    // Read the expression, building the NFA and its states array
+    st   = read_expr(&input, &states, &stack, &nfa);
+    *end = input.offset;
+    if (!st && states.failed) {
+      st = REREX_NO_MEMORY;
+    }
+  }
+
+  // The count is exact for every valid pattern
+  assert(st || !(flags & REREX_EXACT_SIZE) ||
+         (states.n_states == states.states_capacity &&
+          states.n_sets == states.sets_capacity));
+
+  // Allocate a new pattern and build everything from the parsed NFA
+  RerexPattern* const result =
+    st ? NULL : (RerexPattern*)mem_calloc(alloc, 1, sizeof(RerexPattern));
+  if (!st && !result) {
+    st = REREX_NO_MEMORY;
+  }
+
+  if (!st) {
+    // Move the sets to the pattern, shrinking them to fit if necessary
+    if (states.n_sets < states.sets_capacity) {
+      reserve_states(&states, states.n_states, states.n_sets);
+    }
+
+    result->allocator = alloc;
+    result->sets      = states.sets;
+    states.sets       = NULL;
+    if (!(st = build_positions(result, &states, nfa.start)) &&
+        !(st = build_labels(result)) &&
+        ((flags & REREX_FORCE_NFA) || !(st = build_bits(result))) &&
+        !(st = find_literals(result)) && !(st = find_lengths(result))) {
+      compute_classes(result);
+      st = plan_engine(result, flags);
+    }
+
+    if (!st) {
+      *out = result;
+    } else {
+      rerex_free_pattern(result);
+    }
+  }
+
+  mem_free(alloc, stack.data);
+  mem_free(alloc, states.sets);
+  mem_free(alloc, states.states);
+  return st;
+}
+
+/* Matcher */
+
+/* Lazy DFA.
+
+   A lazy DFA is built from the NFA on the fly while matching.  Each DFA state
+   is a set of active NFA states, and each transition is computed by NFA
+   simulation the first time it is taken, then cached so that taking it again
+   is a single table lookup.  The cache has a fixed size, and is flushed
+   entirely when it is full.  If it is flushed too often, the cache is
+   thrashing and is slower than the NFA, so matching falls back to simulating
+   the NFA directly for the rest of the input.
+*/
+
+// Minimum average number of bytes matched per DFA state between flushes
+static const size_t min_bytes_per_state = 10U;
+
+typedef struct {
+  size_t   set;       ///< Offset of the first NFA state in the pool
+  size_t   n_set;     ///< Number of NFA states in the set
+  uint32_t hash;      ///< Hash of the NFA state set
+  bool     accepting; ///< True if the set contains a match state
+} DfaState;
+
+typedef struct {
+  DfaIndex*   next;          ///< Transition table, one row per state
+  DfaState*   dstates;       ///< DFA states, indexed by DfaIndex
+  DfaIndex*   buckets;       ///< Hash table of states, zero if empty
+  StateIndex* pool;          ///< Sorted NFA state sets of all states
+  size_t      n_classes;     ///< Number of columns in transition table
+  size_t      n_dstates;     ///< Number of states, including unused zero
+  size_t      max_dstates;   ///< Maximum number of states, or zero
+  size_t      n_buckets;     ///< Number of hash buckets, a power of two
+  size_t      pool_size;     ///< Number of NFA state indices in pool
+  size_t      pool_capacity; ///< Maximum number of NFA state indices in pool
+  size_t      n_bytes;       ///< Number of bytes matched since last flush
+  DfaIndex    start;         ///< Start state, or zero if unknown
+  DfaIndex    dead;          ///< State with no active NFA states
+} Dfa;
+
+// Return an FNV-1a hash of a set of NFA states
+static uint32_t
+hash_set(const StateIndex* const set, const size_t n_set)
+{
+  uint32_t hash = 2166136261U;
+  for (size_t i = 0U; i < n_set; ++i) {
+    // Multiply in 64 bits and truncate, so the product doesn't wrap
+    const uint64_t product = (uint64_t)(hash ^ set[i]) * 16777619U;
+
+    hash = (uint32_t)(product & UINT32_MAX);
+  }
+
+  return hash;
+}
+
+// Compare two state indices for sorting
+static int
+compare_indices(const void* const lhs, const void* const rhs)
+{
+  const StateIndex l = *(const StateIndex*)lhs;
+  const StateIndex r = *(const StateIndex*)rhs;
+
+  return (l > r) - (l < r);
+}
+
+// Return the state for a sorted set of NFA states, adding it if necessary
+static DfaIndex
+dfa_intern(Dfa* const             dfa,
+           const StateIndex* const set,
+           const size_t           n_set,
+           const bool             accepting)
+{
+  const uint32_t hash = hash_set(set, n_set);
+  const size_t   mask = dfa->n_buckets - 1U;
+
+  // Search for an existing state with the same set
+  size_t b = hash & mask;
+  for (; dfa->buckets[b]; b = (b + 1U) & mask) {
+    const DfaIndex        index = dfa->buckets[b];
+    const DfaState* const d     = &dfa->dstates[index];
+    if (d->hash == hash && d->n_set == n_set &&
+        (!n_set || !memcmp(dfa->pool + d->set, set, n_set * sizeof(*set)))) {
+      return index;
+    }
+  }
+
+  // Fail if there isn't enough room left for a new state
+  if (dfa->n_dstates == dfa->max_dstates ||
+      dfa->pool_capacity - dfa->pool_size < n_set) {
+    return 0U;
+  }
+
+  // Add a new state with no known transitions
+  const DfaIndex  index = (DfaIndex)dfa->n_dstates++;
+  DfaState* const d     = &dfa->dstates[index];
+
+  d->set       = dfa->pool_size;
+  d->n_set     = n_set;
+  d->hash      = hash;
+  d->accepting = accepting;
+  if (n_set) {
+    memcpy(dfa->pool + dfa->pool_size, set, n_set * sizeof(*set));
+    dfa->pool_size += n_set;
+  }
+
+  memset(dfa->next + (index * dfa->n_classes),
+         0,
+         dfa->n_classes * sizeof(DfaIndex));
+  dfa->buckets[b] = index;
+  return index;
+}
+
+// Return the state for the positions in `list`, adding it if necessary
+static DfaIndex
+dfa_intern_list(Dfa* const dfa, const IndexList* const list)
+{
+  // Sort the list, which puts the final position first if it's present
+  qsort(list->indices, list->n_indices, sizeof(StateIndex), compare_indices);
+
+  const bool accepting = list->n_indices && list->indices[0] == FINAL;
+
+  return dfa_intern(dfa, list->indices, list->n_indices, accepting);
+}
+
+// Remove every state from a DFA except the dead state
+static void
+dfa_flush(Dfa* const dfa)
+{
+  memset(dfa->buckets, 0, dfa->n_buckets * sizeof(DfaIndex));
+  dfa->n_dstates = 1U;
+  dfa->pool_size = 0U;
+  dfa->n_bytes   = 0U;
+  dfa->start     = 0U;
+  dfa->dead      = dfa_intern(dfa, NULL, 0U, false);
+}
+
+// Resize a DFA to have room for the given number of states and NFA states
+static RerexStatus
+dfa_resize(RerexAllocator* const allocator,
+           Dfa* const            dfa,
+           const size_t          max_dstates,
+           const size_t          pool_capacity)
+{
+  size_t n_buckets = 1U;
+  while (n_buckets < 2U * max_dstates) {
+    n_buckets *= 2U;
+  }
+
+  const size_t next_size = max_dstates * dfa->n_classes * sizeof(DfaIndex);
+
+  DfaIndex* const next =
+    (DfaIndex*)mem_realloc(allocator, dfa->next, next_size);
+  if (!next) {
+    return REREX_NO_MEMORY;
+  }
+
+  dfa->next = next;
+
+  const size_t dstates_size = max_dstates * sizeof(DfaState);
+
+  DfaState* const dstates =
+    (DfaState*)mem_realloc(allocator, dfa->dstates, dstates_size);
+  if (!dstates) {
+    return REREX_NO_MEMORY;
+  }
+
+  dfa->dstates = dstates;
+
+  const size_t pool_size = pool_capacity * sizeof(StateIndex);
+
+  StateIndex* const pool =
+    (StateIndex*)mem_realloc(allocator, dfa->pool, pool_size);
+  if (!pool) {
+    return REREX_NO_MEMORY;
+  }
+
+  dfa->pool = pool;
+
+  DfaIndex* const buckets =
+    (DfaIndex*)mem_calloc(allocator, n_buckets, sizeof(DfaIndex));
+  if (!buckets) {
+    return REREX_NO_MEMORY;
+  }
+
+  // Rehash every existing state into the new buckets
+  const size_t mask = n_buckets - 1U;
+  for (size_t i = 1U; i < dfa->n_dstates; ++i) {
+    size_t b = dstates[i].hash & mask;
+    while (buckets[b]) {
+      b = (b + 1U) & mask;
+    }
+
+    buckets[b] = (DfaIndex)i;
+  }
+
+  mem_free(allocator, dfa->buckets);
+  dfa->buckets       = buckets;
+  dfa->max_dstates   = max_dstates;
+  dfa->n_buckets     = n_buckets;
+  dfa->pool_capacity = pool_capacity;
+  return REREX_SUCCESS;
+}
+
+// Free everything allocated for a DFA and reset it to a disabled state
+static void
+dfa_free(RerexAllocator* const allocator, Dfa* const dfa)
+{
+  mem_free(allocator, dfa->pool);
+  mem_free(allocator, dfa->buckets);
+  mem_free(allocator, dfa->dstates);
+  mem_free(allocator, dfa->next);
+  memset(dfa, 0, sizeof(Dfa));
+}
+
+/* Matcher.
+
+   The matcher tracks active states by keeping two lists of indices: one for
+   the current iteration, and one for the next.  A separate array, keyed by
+   state index, stores the number of the last iteration the state was entered
+   in.  This makes it simple and fast to check if a state has already been
+   entered in the current iteration, avoiding the need to search the active
+   list for every entered state.
+
+   Steps are numbered from a base which is raised past every step used so far
+   whenever the matcher is reset, so old entries can never equal a current
+   step, and resetting takes constant time regardless of the pattern size.
+   The array only needs to be cleared when the matcher is first used, or in
+   the unlikely event that step numbers run out.
+*/
+/* Stream.
+
+   A stream is matched incrementally as chunks are fed to the matcher, so its
+   state must be kept between calls.  If the pattern has bit-parallel tables,
+   this is simply the set of active positions.  Otherwise, it is the current
+   active list of the NFA simulation, which was entered at the step that is
+   the number of bytes fed so far.
+*/
+typedef struct {
+  Word   bits[MAX_WORDS]; ///< Active positions, if bit-parallel
+  size_t n_bytes;         ///< Number of bytes fed since the last reset
+  bool   phase;           ///< Index of the current active list otherwise
+} Stream;
+
+struct RerexMatcherImpl {
+  RerexAllocator*     allocator;   // Allocator for everything in the matcher
+  const RerexPattern* regexp;      // Pattern to match against
+  IndexList           active[2];   // Two lists of active states
   size_t*             last_active; // Last iteration a state was active
+  size_t              base;        // Iteration of step zero since reset
+  size_t              top;         // Iteration after the last one used
+  Dfa                 dfa;         // Lazy DFA cache, if enabled
+  Stream              stream;      // State of an incremental match
+  size_t*             origins[2];  // Start offset of every active thread
+  size_t              capacity;    // Number of positions arrays can hold
+  const RerexSet*     set;         // Set of patterns, for set matchers
+};
+
+RerexMatcher*
+rerex_new_matcher(const RerexPattern* const regexp)
+{
+  return rerex_new_matcher_alloc(regexp->allocator, regexp);
+}
+
+RerexMatcher*
+rerex_new_matcher_alloc(RerexAllocator* const     allocator,
+                        const RerexPattern* const regexp)
+{
+  RerexAllocator* const a = get_allocator(allocator);
+  const size_t          n = regexp->n_positions;
+
+  RerexMatcher* const m = (RerexMatcher*)mem_calloc(a, 1, sizeof(RerexMatcher));
+  if (m) {
+    m->allocator         = a;
+    m->regexp            = regexp;
+    m->active[0].indices = (StateIndex*)mem_calloc(a, n, sizeof(StateIndex));
+    m->active[1].indices = (StateIndex*)mem_calloc(a, n, sizeof(StateIndex));
+    m->last_active       = (size_t*)mem_calloc(a, n, sizeof(size_t));
+    m->origins[0]        = (size_t*)mem_calloc(a, n, sizeof(size_t));
+    m->origins[1]        = (size_t*)mem_calloc(a, n, sizeof(size_t));
+    if (!m->active[0].indices || !m->active[1].indices || !m->last_active ||
+        !m->origins[0] || !m->origins[1]) {
+      rerex_free_matcher(m);
+      return NULL;
+    }
+
+    m->capacity = n;
+
+    rerex_matcher_reset(m);
+  }
+
+  return m;
+}
+
+size_t
+rerex_matcher_size(const RerexPattern* const pattern)
+{
+  // Last active steps, then two active lists, so everything is aligned
+  return pattern->n_positions * (sizeof(size_t) + (2U * sizeof(StateIndex)));
+}
+
+RerexStatus
+rerex_set_cache_size(RerexMatcher* const matcher, const size_t size)
+{
+  const size_t n_states  = matcher->regexp->n_positions;
+  const size_t n_classes = matcher->regexp->n_classes;
+  const size_t half_size = size / 2U;
+
+  // Each state needs a row, a description, and up to 4 hash buckets
+  const size_t state_size = (n_classes * sizeof(DfaIndex)) + sizeof(DfaState) +
+                            (4U * sizeof(DfaIndex));
+
+  // Use half the space for states, and half for their NFA state sets
+  const size_t max_dstates   = half_size / state_size;
+  const size_t pool_capacity = half_size / sizeof(StateIndex);
+
+  Dfa* const dfa = &matcher->dfa;
+  dfa_free(matcher->allocator, dfa);
+  if (max_dstates < 4U || max_dstates > (size_t)INT32_MAX ||
+      pool_capacity < n_states) {
+    return REREX_SUCCESS; // Size is zero, too small, or absurdly large
+  }
+
+  dfa->n_classes = n_classes;
+  if (dfa_resize(matcher->allocator, dfa, max_dstates, pool_capacity)) {
+    dfa_free(matcher->allocator, dfa);
+    return REREX_NO_MEMORY;
+  }
+
+  dfa_flush(dfa);
+  return REREX_SUCCESS;
+}
+
+void
+rerex_free_matcher(RerexMatcher* const matcher)
+{
+  if (matcher) {
+    RerexAllocator* const allocator = matcher->allocator;
+
+    dfa_free(allocator, &matcher->dfa);
+    mem_free(allocator, matcher->origins[1]);
+    mem_free(allocator, matcher->origins[0]);
+    mem_free(allocator, matcher->last_active);
+    mem_free(allocator, matcher->active[1].indices);
+    mem_free(allocator, matcher->active[0].indices);
+    mem_free(allocator, matcher);
+  }
+}
+
+// Reset matcher to a consistent initial state
+static void
+reset_matcher(RerexMatcher* const matcher)
+{
+  matcher->active[0].n_indices = 0;
+  matcher->active[1].n_indices = 0;
+
+  if (!matcher->base || matcher->top > SIZE_MAX / 2U) {
+    // Clear every entry, if the matcher is new or step numbers are running out
+    const size_t n_states = matcher->regexp->n_positions;
+    for (size_t i = 0; i < n_states; ++i) {
+      matcher->last_active[i] = 0U;
+    }
+
+    matcher->top = 1U;
+  }
+
+  matcher->base = matcher->top;
+}
+
+// Return whether position `p` was entered at `step` since the last reset
+static bool
+entered(const RerexMatcher* const matcher,
+        const StateIndex          p,
+        const size_t              step)
+{
+  return matcher->last_active[p] == matcher->base + step;
+}
+
+// Add every position in a follow list to the active list
+static void
+enter_follows(RerexMatcher* const     matcher,
+              const size_t            step,
+              IndexList* const        list,
+              const StateIndex* const follows,
+              const size_t            n_follows)
+{
+  const size_t iteration = matcher->base + step;
+
+  for (size_t i = 0U; i < n_follows; ++i) {
+    const StateIndex p = follows[i];
+    if (matcher->last_active[p] != iteration) {
+      matcher->last_active[p]          = iteration;
+      list->indices[list->n_indices++] = p;
+    }
+  }
+
+  if (iteration >= matcher->top) {
+    matcher->top = iteration + 1U;
+  }
+}
+
+// Forward declaration for entering the start positions of a pattern set
+static void
+enter_set_start(RerexMatcher* matcher);
+
+// Add the start positions to the first active list, entered at `step`
+static void
+enter_start(RerexMatcher* const matcher, const size_t step)
+{
+  const RerexPattern* const pattern = matcher->regexp;
+
+  enter_follows(matcher,
+                step,
+                &matcher->active[0],
+                pattern->follows + pattern->start,
+                pattern->n_start);
+}
+
+// Number of active positions tested at once in a step
+#define STEP_BLOCK 64U
+
+/* Enter the follows of every position in `indices` that accepts `c`.
+
+   Positions are processed in blocks.  The labels of a block are tested
+   without branching, appending every position to a small buffer but only
+   advancing past the ones that may match, so the loop that touches every
+   active position is tight and predictable.  Only the remaining candidates
+   are then checked exactly, and have their follows entered in order.
+*/
+static void
+step_positions(RerexMatcher* const     matcher,
+               const StateIndex* const indices,
+               const size_t            n_indices,
+               const char              c,
+               const size_t            step,
+               IndexList* const        list)
+{
+  const RerexPattern* const pattern = matcher->regexp;
+  const Label* const        labels  = pattern->labels;
+  const uint8_t             byte    = (uint8_t)c;
+
+  for (size_t i = 0U; i < n_indices; i += STEP_BLOCK) {
+    const size_t n_block = n_indices - i < STEP_BLOCK ? n_indices - i
+                                                      : STEP_BLOCK;
+    StateIndex   hits[STEP_BLOCK];
+    size_t       n_hits = 0U;
+
+    // Keep every position whose label range contains the byte
+    for (size_t j = 0U; j < n_block; ++j) {
+      const StateIndex p = indices[i + j];
+
+      hits[n_hits] = p;
+      n_hits += (size_t)((labels[p].min <= byte) & (byte <= labels[p].max));
+    }
+
+    // Enter the follows of every candidate that really matches
+    for (size_t j = 0U; j < n_hits; ++j) {
+      const Position* const p = &pattern->positions[hits[j]];
+      if (p->min != REREX_CLASS || set_contains(&pattern->sets[p->max], c)) {
+        enter_follows(
+          matcher, step, list, pattern->follows + p->follow, p->n_follow);
+      }
+    }
+  }
+}
+
+/* Run the NFA on `string` from the active list `active[phase]`.
+
+   The active list was entered at `step`, and the list entered after the last
+   character is returned, which is empty if the simulation stopped early
+   because no positions were active.
+*/
+static bool
+run_nfa(RerexMatcher* const matcher,
+        bool                phase,
+        const char* const   string,
+        const size_t        len,
+        const size_t        step)
+{
+  // Tick the matcher for every input character
+  for (size_t i = 0U; i < len && matcher->active[phase].n_indices; ++i) {
+    const IndexList* const list      = &matcher->active[phase];
+    IndexList* const       next_list = &matcher->active[!phase];
+
+    // Add successor positions to the next iteration's list
+    next_list->n_indices = 0;
+    step_positions(matcher,
+                   list->indices,
+                   list->n_indices,
+                   string[i],
+                   step + i + 1U,
+                   next_list);
+
+    // Flip phase to swap active lists
+    phase = !phase;
+  }
+
+  return phase;
+}
+
+// Set the first active list to the successors of DFA state `from` on `c`
+static void
+dfa_successors(RerexMatcher* const matcher,
+               const DfaIndex      from,
+               const char          c,
+               const size_t        step)
+{
+  const Dfa* const      dfa  = &matcher->dfa;
+  IndexList* const      list = &matcher->active[0];
+  const DfaState* const d    = &dfa->dstates[from];
+
+  list->n_indices = 0U;
+  step_positions(matcher, dfa->pool + d->set, d->n_set, c, step, list);
+}
+
+// Compute and cache the DFA transition from `from` on the character at `i`
+static DfaIndex
+lazy_transition(RerexMatcher* const matcher,
+                const DfaIndex      from,
+                const char* const   string,
+                const size_t        i)
+{
+  const RerexPattern* const pattern = matcher->regexp;
+  Dfa* const                dfa     = &matcher->dfa;
+  IndexList* const          list    = &matcher->active[0];
+  const char                c       = string[i];
+
+  dfa_successors(matcher, from, c, i + 1U);
+
+  const DfaIndex to = dfa_intern_list(dfa, list);
+  if (to) {
+    const uint8_t cls = pattern->classes[(uint8_t)c];
+
+    dfa->next[(from * dfa->n_classes) + cls] = to;
+    return to;
+  }
+
+  // The cache is full, so flush it, and start over unless it's thrashing
+  const bool thrashing = dfa->n_bytes < min_bytes_per_state * dfa->n_dstates;
+  dfa_flush(dfa);
+  return thrashing ? 0U : dfa_intern_list(dfa, list);
+}
+
+// Match using the lazy DFA, falling back to the NFA if the cache thrashes
+static bool
+match_lazy(RerexMatcher* const matcher,
+           const char* const   string,
+           const size_t        len)
+{
+  const RerexPattern* const pattern = matcher->regexp;
+  Dfa* const                dfa     = &matcher->dfa;
+  bool                      reset   = false;
+
+  // Enter the start state, computing it if the cache was flushed
+  if (!dfa->start) {
+    reset_matcher(matcher);
+    reset = true;
+    enter_start(matcher, 0U);
+    if (!(dfa->start = dfa_intern_list(dfa, &matcher->active[0]))) {
+      // The cache filled up again since the flush, so flush it again
+      dfa_flush(dfa);
+      dfa->start = dfa_intern_list(dfa, &matcher->active[0]); // Can't fail
+    }
+  }
+
+  // Follow cached transitions, computing them with the NFA on a miss
+  DfaIndex s       = dfa->start;
+  size_t   counted = 0U;
+  size_t   i       = 0U;
+  for (; i < len; ++i) {
+    const uint8_t cls  = pattern->classes[(uint8_t)string[i]];
+    DfaIndex      next = dfa->next[(s * dfa->n_classes) + cls];
+
+    if (!next) {
+      if (!reset) {
+        // Reset the matcher lazily, since it isn't needed if every step hits
+        reset_matcher(matcher);
+        reset = true;
+      }
+
+      dfa->n_bytes += i - counted;
+      counted = i;
+      if (!(next = lazy_transition(matcher, s, string, i))) {
+        run_nfa(matcher, false, string + i + 1U, len - i - 1U, i + 1U);
+        return entered(matcher, FINAL, len);
+      }
+    }
+
+    if (next == dfa->dead) {
+      return false;
+    }
+
+    s = next;
+  }
+
+  dfa->n_bytes += i - counted;
+  return dfa->dstates[s].accepting;
+}
+
+// Run the complete DFA from state `s`, returning the state after `string`
+static DfaIndex
+run_dfa(const RerexPattern* const pattern,
+        DfaIndex                  s,
+        const char* const         string,
+        const size_t              len)
+{
+  const DfaTable* const dfa       = &pattern->dfa;
+  const size_t          n_classes = pattern->n_classes;
+
+  for (size_t i = 0U; i < len; ++i) {
+    const uint8_t cls = pattern->classes[(uint8_t)string[i]];
+
+    if ((s = dfa->next[(s * n_classes) + cls]) == dfa->dead) {
+      break;
+    }
+  }
+
+  return s;
+}
+
+// Match using the complete DFA of the pattern
+static bool
+match_dfa(const RerexPattern* const pattern,
+          const char* const         string,
+          const size_t              len)
+{
+  const DfaTable* const dfa = &pattern->dfa;
+
+  return dfa->accepting[run_dfa(pattern, dfa->start, string, len)];
+}
+
+// Hint that the memory at `addr` will be read soon
+#if defined(__GNUC__)
+#  define PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#  define PREFETCH(addr)
+#endif
+
+// Return the index of the lowest set bit in `word`, which must not be zero
+static unsigned
+lowest_bit(const Word word)
+{
+#if defined(__GNUC__)
+  return (unsigned)__builtin_ctzll(word);
+#else
+  unsigned index = 0U;
+  for (Word w = word; !(w & 1U); w >>= 1U) {
+    ++index;
+  }
+
+  return index;
+#endif
+}
+
+// Run one word bit-parallel simulation from `active` and return the result
+static Word
+run_bits1(const BitTable* const bits,
+          Word                  active,
+          const char* const     string,
+          const size_t          len)
+{
+  for (size_t i = 0U; i < len; ++i) {
+    // Mask out positions that don't match, and combine the remaining follows
+    Word matched = active & bits->masks[(uint8_t)string[i]];
+    active       = 0U;
+    for (; matched; matched &= matched - 1U) {
+      active |= bits->follows[lowest_bit(matched)];
+    }
+
+    if (!active) {
+      return 0U;
+    }
+  }
+
+  return active;
+}
+
+// Match using bit-parallel simulation of a pattern with one word sets
+static bool
+match_bits1(const BitTable* const bits,
+            const char* const     string,
+            const size_t          len)
+{
+  return run_bits1(bits, bits->start[0], string, len) & 1U;
+}
+
+// Add the follow sets of positions in `matched` (word `w` of a set) to `next`
+static void
+add_follows(const BitTable* const bits,
+            const size_t          w,
+            Word                  matched,
+            Word* const           next)
+{
+  const size_t n_words = bits->n_words;
+
+  for (; matched; matched &= matched - 1U) {
+    const size_t      p      = (w * 64U) + lowest_bit(matched);
+    const Word* const follow = bits->follows + (p * n_words);
+    for (size_t v = 0U; v < n_words; ++v) {
+      next[v] |= follow[v];
+    }
+  }
+}
+
+// Run multi-word bit-parallel simulation, updating `active` in place
+static void
+run_bits(const BitTable* const bits,
+         Word* const           active,
+         const char* const     string,
+         const size_t          len)
+{
+  const size_t n_words = bits->n_words;
+
+  for (size_t i = 0U; i < len; ++i) {
+    const size_t      row             = (uint8_t)string[i] * n_words;
+    const Word* const mask            = bits->masks + row;
+    Word              next[MAX_WORDS] = {0U, 0U, 0U, 0U};
+    Word              any             = 0U;
+
+    // Combine the follows of every active position that matches
+    for (size_t w = 0U; w < n_words; ++w) {
+      add_follows(bits, w, active[w] & mask[w], next);
+    }
+
+    for (size_t w = 0U; w < n_words; ++w) {
+      any |= (active[w] = next[w]);
+    }
+
+    if (!any) {
+      return;
+    }
+  }
+}
+
+// Match using bit-parallel simulation of a pattern with multi-word sets
+static bool
+match_bits(const BitTable* const bits,
+           const char* const     string,
+           const size_t          len)
+{
+  Word active[MAX_WORDS] = {0U, 0U, 0U, 0U};
+
+  memcpy(active, bits->start, sizeof(active));
+  run_bits(bits, active, string, len);
+  return active[0] & 1U;
+}
+
+// Return whether `string` has the literal prefix and suffix of `pattern`
+static bool
+has_literals(const RerexPattern* const pattern,
+             const char* const         string,
+             const size_t              len)
+{
+  // Both literals are at most the minimum length, which was already checked
+  const size_t prefix_len = pattern->prefix_len;
+  const size_t suffix_len = pattern->suffix_len;
+
+  return (!prefix_len || !memcmp(string, pattern->prefix, prefix_len)) &&
+         (!suffix_len ||
+          !memcmp(string + len - suffix_len, pattern->suffix, suffix_len));
+}
+
+bool
+rerex_match(RerexMatcher* const matcher, const char* const string)
+{
+  return rerex_match_n(matcher, string, strlen(string));
+}
+
+bool
+rerex_match_n(RerexMatcher* const matcher,
+              const char* const   string,
+              const size_t        len)
+{
+  const RerexPattern* const pattern = matcher->regexp;
+
+  if (len < pattern->min_length || len > pattern->max_length ||
+      !has_literals(pattern, string, len)) {
+    return false;
+  }
+
+  if (pattern->engine == REREX_ENGINE_LITERAL) {
+    return true; // The literals checked above are the entire string
+  }
+
+  if (pattern->dfa.next) {
+    return match_dfa(pattern, string, len);
+  }
+
+  if (matcher->dfa.max_dstates) {
+    return match_lazy(matcher, string, len);
+  }
+
+  if (pattern->bits.n_words == 1U) {
+    return match_bits1(&pattern->bits, string, len);
+  }
+
+  if (pattern->bits.n_words) {
+    return match_bits(&pattern->bits, string, len);
+  }
+
+  // Enter start positions
+  reset_matcher(matcher);
+  enter_start(matcher, 0U);
+
+  // Check if the final position was entered after the last character
+  run_nfa(matcher, false, string, len, 0U);
+  return entered(matcher, FINAL, len);
+}
+
+bool
+rerex_match_scratch(const RerexPattern* const pattern,
+                    void* const               scratch,
+                    const char* const         string,
+                    const size_t              len)
+{
+  const size_t n_states = pattern->n_positions;
+  RerexMatcher matcher;
+
+  // Set up a temporary matcher with arrays in the scratch memory
+  memset(&matcher, 0, sizeof(matcher));
+  matcher.regexp            = pattern;
+  matcher.last_active       = (size_t*)scratch;
+  matcher.active[0].indices = (StateIndex*)(matcher.last_active + n_states);
+  matcher.active[1].indices = matcher.active[0].indices + n_states;
+  matcher.capacity          = n_states;
+
+  return rerex_match_n(&matcher, string, len);
+}
+
+/* Match a group of up to 8 strings in lockstep with the complete DFA.
+
+   Matching one string is a chain of dependent table loads, which stalls on
+   every cache miss when the table is large.  Advancing several strings
+   together makes their loads independent, so the misses overlap, and the row
+   each string needs next is prefetched while the others advance.
+*/
+static uint8_t
+match_dfa_lanes(const RerexPattern* const pattern,
+                const char* const* const  strings,
+                const size_t* const       lens,
+                const unsigned            n_lanes)
+{
+  const DfaTable* const dfa       = &pattern->dfa;
+  const size_t          n_classes = pattern->n_classes;
+
+  DfaIndex s[8]    = {0U, 0U, 0U, 0U, 0U, 0U, 0U, 0U};
+  unsigned live    = 0U; // Bit for each lane that hasn't finished
+  unsigned matches = 0U; // Bit for each lane that matched
+
+  for (unsigned l = 0U; l < n_lanes; ++l) {
+    s[l] = dfa->start;
+    if (lens[l] >= pattern->min_length && lens[l] <= pattern->max_length &&
+        has_literals(pattern, strings[l], lens[l])) {
+      live |= 1U << l;
+    }
+  }
+
+  for (size_t i = 0U; live; ++i) {
+    for (unsigned l = 0U; l < n_lanes; ++l) {
+      const unsigned bit = 1U << l;
+
+      if (!(live & bit)) {
+        continue;
+      }
+
+      if (i == lens[l]) {
+        live &= ~bit;
+        matches |= dfa->accepting[s[l]] ? bit : 0U;
+        continue;
+      }
+
+      const uint8_t cls = pattern->classes[(uint8_t)strings[l][i]];
+      if ((s[l] = dfa->next[(s[l] * n_classes) + cls]) == dfa->dead) {
+        live &= ~bit;
+      } else {
+        PREFETCH(&dfa->next[s[l] * n_classes]);
+      }
+    }
+  }
+
+  return (uint8_t)matches;
+}
+
+// Match a group of up to 8 strings in a batch, returning a byte of results
+static uint8_t
+match_group(RerexMatcher* const      matcher,
+            const char* const* const strings,
+            const size_t* const      lens,
+            const unsigned           n_lanes)
+{
+  if (matcher->regexp->dfa.next) {
+    return match_dfa_lanes(matcher->regexp, strings, lens, n_lanes);
+  }
+
+  unsigned byte = 0U;
+  for (unsigned l = 0U; l < n_lanes; ++l) {
+    if (rerex_match_n(matcher, strings[l], lens[l])) {
+      byte |= 1U << l;
+    }
+  }
+
+  return (uint8_t)byte;
+}
+
+void
+rerex_match_batch(RerexMatcher* const          matcher,
+                  const RerexStringView* const strings,
+                  const size_t                 n,
+                  uint8_t* const               results)
+{
+  for (size_t i = 0U; i < n; i += 8U) {
+    const unsigned n_lanes = n - i < 8U ? (unsigned)(n - i) : 8U;
+    const char*    group[8];
+    size_t         lens[8];
+
+    for (unsigned l = 0U; l < n_lanes; ++l) {
+      group[l] = strings[i + l].data;
+      lens[l]  = strings[i + l].len;
+    }
+
+    results[i / 8U] = match_group(matcher, group, lens, n_lanes);
+  }
+}
+
+void
+rerex_match_offsets(RerexMatcher* const  matcher,
+                    const char* const    data,
+                    const int32_t* const offsets,
+                    const size_t         n,
+                    uint8_t* const       results)
+{
+  for (size_t i = 0U; i < n; i += 8U) {
+    const unsigned n_lanes = n - i < 8U ? (unsigned)(n - i) : 8U;
+    const char*    group[8];
+    size_t         lens[8];
+
+    for (unsigned l = 0U; l < n_lanes; ++l) {
+      const size_t begin = (size_t)offsets[i + l];
+
+      group[l] = data + begin;
+      lens[l]  = (size_t)offsets[i + l + 1U] - begin;
+    }
+
+    results[i / 8U] = match_group(matcher, group, lens, n_lanes);
+  }
+}
+
+/* Parallel batches are split into a few chunks per worker, for balance.
+   Chunks are a multiple of 64 strings, so each writes whole 8-byte words of
+   the result bitmap.  They are at most 512 strings, which is a 64-byte block
+   of the bitmap, so large batches don't share cache lines between chunks if
+   the bitmap is aligned. */
+#define MIN_CHUNK_STRINGS 64U
+#define MAX_CHUNK_STRINGS 512U
+
+typedef struct {
+  RerexMatcher**         matchers;  // Matcher for each worker
+  const RerexStringView* strings;   // Input strings
+  size_t                 n;         // Number of input strings
+  size_t                 chunk_len; // Number of strings in every full chunk
+  uint8_t*               results;   // Output bitmap
+} Batch;
+
+// Match one chunk of a parallel batch
+static void
+match_chunk(void* const data, const size_t worker, const size_t index)
+{
+  const Batch* const batch = (const Batch*)data;
+  const size_t       size  = batch->chunk_len;
+  const size_t       first = index * size;
+  const size_t       rest  = batch->n - first;
+
+  rerex_match_batch(batch->matchers[worker],
+                    batch->strings + first,
+                    rest < size ? rest : size,
+                    batch->results + first / 8U);
+}
+
+RerexStatus
+rerex_match_parallel(const RerexPattern* const    pattern,
+                     const RerexStringView* const strings,
+                     const size_t                 n,
+                     uint8_t* const               results,
+                     const size_t                 n_workers,
+                     const RerexExecutor          executor,
+                     void* const                  context)
+{
+  if (!n) {
+    return REREX_SUCCESS;
+  }
+
+  // Aim for 4 chunks per worker, rounded up to a whole number of words
+  const size_t n_max    = n_workers < n ? n_workers : n;
+  const size_t n_wanted = executor && n_max ? n_max : 1U;
+  const size_t ideal    = (n + (4U * n_wanted) - 1U) / (4U * n_wanted);
+  const size_t n_words  = (ideal + MIN_CHUNK_STRINGS - 1U) / MIN_CHUNK_STRINGS;
+  const size_t size     = n_words * MIN_CHUNK_STRINGS;
+  const size_t chunk    = size < MAX_CHUNK_STRINGS ? size : MAX_CHUNK_STRINGS;
+  const size_t n_tasks  = (n + chunk - 1U) / chunk;
+  const size_t n_used   = n_wanted < n_tasks ? n_wanted : n_tasks;
+
+  Batch batch = {NULL, strings, n, chunk, results};
+
+  // Allocate a matcher for each worker
+  batch.matchers = (RerexMatcher**)mem_calloc(
+    pattern->allocator, n_used, sizeof(RerexMatcher*));
+  if (!batch.matchers) {
+    return REREX_NO_MEMORY;
+  }
+
+  RerexStatus st = REREX_SUCCESS;
+  for (size_t w = 0U; w < n_used; ++w) {
+    if (!(batch.matchers[w] = rerex_new_matcher(pattern))) {
+      st = REREX_NO_MEMORY;
+      break;
+    }
+  }
+
+  // Match every chunk
+  if (!st && executor) {
+    executor(context, n_used, n_tasks, match_chunk, &batch);
+  } else if (!st) {
+    for (size_t i = 0U; i < n_tasks; ++i) {
+      match_chunk(&batch, 0U, i);
+    }
+  }
+
+  for (size_t w = 0U; w < n_used; ++w) {
+    rerex_free_matcher(batch.matchers[w]);
+  }
+
+  mem_free(pattern->allocator, batch.matchers);
+  return st;
+}
+
+/* Chunked matching.
+
+   A single long string can be matched in parallel with the complete DFA by
+   splitting it into chunks.  The state a chunk starts in isn't known until the
+   previous chunks are matched, so each chunk is speculatively run from every
+   state, which gives a mapping from start states to end states.  The mappings
+   are then joined in order from the start state of the DFA.  This does more
+   work in total, by a factor of up to the number of states, but is still
+   linear in the length of the input.  So, chunks are only used if there are
+   no more live states than workers, and no more than a small fixed number,
+   otherwise a single scan is both faster and cheaper.
+*/
+
+// Minimum length of a chunk, so short strings aren't split needlessly
+#define MIN_CHUNK_LEN 4096U
+
+// Maximum number of live DFA states to run every chunk from
+#define MAX_SPECULATIVE_STATES 16U
+
+typedef struct {
+  const RerexPattern* pattern;   // Pattern with a complete DFA
+  const char*         string;    // Input string
+  size_t              len;       // Length of input string
+  size_t              chunk_len; // Length of every chunk but the last
+  DfaIndex*           ends;      // End state for each chunk and start state
+} Speculation;
+
+// Run one chunk of a string from every possible start state
+static void
+match_speculative(void* const data, const size_t worker, const size_t index)
+{
+  const Speculation* const spec  = (const Speculation*)data;
+  const DfaTable* const    dfa   = &spec->pattern->dfa;
+  const size_t             size  = spec->chunk_len;
+  const char* const        chunk = spec->string + (index * size);
+  const size_t             rest  = spec->len - (index * size);
+  const size_t             n     = rest < size ? rest : size;
+  DfaIndex* const          ends  = spec->ends + (index * dfa->n_dstates);
+
+  (void)worker;
+
+  for (DfaIndex s = 1U; s < dfa->n_dstates; ++s) {
+    if (index == 0U && s != dfa->start) {
+      continue; // The first chunk always starts in the start state
+    }
+
+    ends[s] = s == dfa->dead ? s : run_dfa(spec->pattern, s, chunk, n);
+  }
+}
+
+RerexStatus
+rerex_match_chunked(const RerexPattern* const pattern,
+                    const char* const         string,
+                    const size_t              len,
+                    const size_t              n_workers,
+                    const RerexExecutor       executor,
+                    void* const               context,
+                    bool* const               match)
+{
+  const DfaTable* const dfa = &pattern->dfa;
+
+  if (len < pattern->min_length || len > pattern->max_length ||
+      !has_literals(pattern, string, len)) {
+    *match = false;
+    return REREX_SUCCESS;
+  }
+
+  // Without a DFA, match on the calling thread with a temporary matcher
+  if (!dfa->next) {
+    RerexMatcher* const matcher = rerex_new_matcher(pattern);
+    if (!matcher) {
+      return REREX_NO_MEMORY;
+    }
+
+    *match = rerex_match_n(matcher, string, len);
+    rerex_free_matcher(matcher);
+    return REREX_SUCCESS;
+  }
+
+  // Scan sequentially if running from every live state would cost too much
+  const size_t n_live    = dfa->n_dstates - 2U; // Excluding zero and dead
+  const bool   speculate = executor && n_workers && n_live <= n_workers &&
+                         n_live <= MAX_SPECULATIVE_STATES;
+
+  // Split the string into a few chunks per worker, for balance
+  const size_t n_wanted  = speculate ? 4U * n_workers : 1U;
+  const size_t n_max     = (len + MIN_CHUNK_LEN - 1U) / MIN_CHUNK_LEN;
+  const size_t n_split   = n_wanted < n_max ? n_wanted : n_max;
+  const size_t chunk_len = n_split > 1U ? (len + n_split - 1U) / n_split : 0U;
+  if (!chunk_len) {
+    *match = match_dfa(pattern, string, len);
+    return REREX_SUCCESS;
+  }
+
+  const size_t n_chunks = (len + chunk_len - 1U) / chunk_len;
+  Speculation  spec     = {pattern, string, len, chunk_len, NULL};
+
+  spec.ends = (DfaIndex*)mem_calloc(
+    pattern->allocator, n_chunks * dfa->n_dstates, sizeof(DfaIndex));
+  if (!spec.ends) {
+    return REREX_NO_MEMORY;
+  }
+
+  // Map every chunk, then join the mappings from the start state
+  executor(context, n_workers, n_chunks, match_speculative, &spec);
+
+  DfaIndex s = dfa->start;
+  for (size_t c = 0U; c < n_chunks && s != dfa->dead; ++c) {
+    s = spec.ends[(c * dfa->n_dstates) + s];
+  }
+
+  mem_free(pattern->allocator, spec.ends);
+  *match = dfa->accepting[s];
+  return REREX_SUCCESS;
+}
+
+void
+rerex_matcher_reset(RerexMatcher* const matcher)
+{
+  const RerexPattern* const pattern = matcher->regexp;
+  Stream* const             stream  = &matcher->stream;
+
+  memcpy(stream->bits, pattern->bits.start, sizeof(stream->bits));
+  stream->n_bytes = 0U;
+  stream->phase   = false;
+  if (!pattern->bits.n_words) {
+    reset_matcher(matcher);
+    if (matcher->set) {
+      enter_set_start(matcher);
+    } else {
+      enter_start(matcher, 0U);
+    }
+  }
+}
+
+// Return the progress of the stream of `matcher`
+static RerexProgress
+stream_progress(const RerexMatcher* const matcher)
+{
+  const BitTable* const bits   = &matcher->regexp->bits;
+  const Stream* const   stream = &matcher->stream;
+
+  if (bits->n_words) {
+    Word any = 0U;
+    for (size_t w = 0U; w < bits->n_words; ++w) {
+      any |= stream->bits[w];
+    }
+
+    return (stream->bits[0] & 1U) ? REREX_ACCEPTING
+           : any                  ? REREX_VIABLE
+                                  : REREX_DEAD;
+  }
+
+  return entered(matcher, FINAL, stream->n_bytes)  ? REREX_ACCEPTING
+         : matcher->active[stream->phase].n_indices ? REREX_VIABLE
+                                                    : REREX_DEAD;
+}
+
+RerexProgress
+rerex_matcher_feed(RerexMatcher* const matcher,
+                   const char* const   chunk,
+                   const size_t        len)
+{
+  const BitTable* const bits   = &matcher->regexp->bits;
+  Stream* const         stream = &matcher->stream;
+
+  if (bits->n_words == 1U) {
+    stream->bits[0] = run_bits1(bits, stream->bits[0], chunk, len);
+  } else if (bits->n_words) {
+    run_bits(bits, stream->bits, chunk, len);
+  } else {
+    const bool phase = stream->phase;
+    stream->phase    = run_nfa(matcher, phase, chunk, len, stream->n_bytes);
+  }
+
+  stream->n_bytes += len;
+  return stream_progress(matcher);
+}
+
+bool
+rerex_matcher_finish(RerexMatcher* const matcher)
+{
+  const bool matches = stream_progress(matcher) == REREX_ACCEPTING;
+
+  rerex_matcher_reset(matcher);
+  return matches;
+}
+
+size_t
+rerex_matcher_save(const RerexMatcher* const matcher,
+                   size_t* const             state,
+                   const size_t              n)
+{
+  const RerexPattern* const pattern = matcher->regexp;
+  const Stream* const       stream  = &matcher->stream;
+
+  if (!pattern->bits.n_words) {
+    const IndexList* const list = &matcher->active[stream->phase];
+    if (list->n_indices <= n) {
+      for (size_t i = 0U; i < list->n_indices; ++i) {
+        state[i] = list->indices[i];
+      }
+    }
+
+    return list->n_indices;
+  }
+
+  // Count the active positions, and write them if there's enough space
+  size_t count = 0U;
+  for (size_t w = 0U; w < pattern->bits.n_words; ++w) {
+    for (Word active = stream->bits[w]; active; active &= active - 1U) {
+      count += 1U;
+    }
+  }
+
+  if (count <= n) {
+    size_t i = 0U;
+    for (size_t w = 0U; w < pattern->bits.n_words; ++w) {
+      for (Word active = stream->bits[w]; active; active &= active - 1U) {
+        state[i++] = (w * 64U) + lowest_bit(active);
+      }
+    }
+  }
+
+  return count;
+}
+
+RerexStatus
+rerex_matcher_restore(RerexMatcher* const matcher,
+                      const size_t* const state,
+                      const size_t        n)
+{
+  const RerexPattern* const pattern = matcher->regexp;
+  Stream* const             stream  = &matcher->stream;
+
+  for (size_t i = 0U; i < n; ++i) {
+    if (state[i] >= pattern->n_positions) {
+      return REREX_BAD_STATE;
+    }
+  }
+
+  stream->n_bytes = 0U;
+  stream->phase   = false;
+  if (pattern->bits.n_words) {
+    memset(stream->bits, 0, sizeof(stream->bits));
+    for (size_t i = 0U; i < n; ++i) {
+      set_bit(stream->bits, state[i]);
+    }
+  } else {
+    reset_matcher(matcher);
+    for (size_t i = 0U; i < n; ++i) {
+      const StateIndex p = (StateIndex)state[i];
+
+      enter_follows(matcher, 0U, &matcher->active[0], &p, 1U);
+    }
+  }
+
+  return REREX_SUCCESS;
+}
+
+/* Search.
+
+   Searching finds a match anywhere in a string, by running the NFA with a new
+   thread started at every offset, and remembering the offset that each thread
+   started at, its origin.  Threads are kept in the active list in order of
+   origin, so when two threads enter the same position, the first to do so is
+   the leftmost, and the other can be dropped since they would behave the same
+   from then on.  Once a match is found, threads that started later can't
+   produce a better one, so they are dropped, and the search ends when no
+   threads remain.
+*/
+
+// Add the follows of a thread to `list`, all with the same origin
+static void
+enter_thread(RerexMatcher* const     matcher,
+             const size_t            step,
+             const bool              phase,
+             const StateIndex* const follows,
+             const size_t            n_follows,
+             const size_t            origin)
+{
+  IndexList* const list   = &matcher->active[phase];
+  const size_t     before = list->n_indices;
+
+  enter_follows(matcher, step, list, follows, n_follows);
+  for (size_t i = before; i < list->n_indices; ++i) {
+    matcher->origins[phase][i] = origin;
+  }
+}
+
+// Return the origin of the final position at `step`, or SIZE_MAX
+static size_t
+final_origin(const RerexMatcher* const matcher,
+             const bool                phase,
+             const size_t              step)
+{
+  if (entered(matcher, FINAL, step)) {
+    const IndexList* const list = &matcher->active[phase];
+    for (size_t i = 0U; i < list->n_indices; ++i) {
+      if (list->indices[i] == FINAL) {
+        return matcher->origins[phase][i];
+      }
+    }
+  }
+
+  return SIZE_MAX;
+}
+
+static bool
+search(RerexMatcher* const   matcher,
+       const char* const     string,
+       const size_t          len,
+       const size_t          from,
+       const RerexSearchMode mode,
+       const bool            any,
+       size_t* const         start,
+       size_t* const         end)
+{
+  const RerexPattern* const pattern = matcher->regexp;
+  const StateIndex* const   follows = pattern->follows;
+  size_t                    best    = SIZE_MAX;
+  bool                      phase   = false;
+
+  if (from > len || len - from < pattern->min_length) {
+    return false;
+  }
+
+  reset_matcher(matcher);
+  for (size_t i = from; i <= len; ++i) {
+    // Start a new thread here, unless a match that started earlier was found
+    if (best == SIZE_MAX) {
+      enter_thread(matcher,
+                   i,
+                   phase,
+                   follows + pattern->start,
+                   pattern->n_start,
+                   i);
+    }
+
+    // Update the best match if the final position was entered
+    const size_t origin = final_origin(matcher, phase, i);
+    if (origin != SIZE_MAX) {
+      if (any) {
+        return true;
+      }
+
+      if (origin < best || mode == REREX_LEFTMOST_LONGEST) {
+        best   = origin;
+        *start = origin;
+        *end   = i;
+      }
+    }
+
+    const IndexList* const list = &matcher->active[phase];
+    IndexList* const       next = &matcher->active[!phase];
+    if (i == len) {
+      break;
+    }
+
+    // Advance threads that could still find a better match
+    next->n_indices = 0U;
+    for (size_t j = 0U; j < list->n_indices; ++j) {
+      const Position* const p = &pattern->positions[list->indices[j]];
+      const size_t          o = matcher->origins[phase][j];
+      if ((o < best || (o == best && mode == REREX_LEFTMOST_LONGEST)) &&
+          accepts(pattern, p, string[i])) {
+        enter_thread(
+          matcher, i + 1U, !phase, follows + p->follow, p->n_follow, o);
+      }
+    }
+
+    if (best != SIZE_MAX && !next->n_indices) {
+      break;
+    }
+
+    phase = !phase;
+  }
+
+  return best != SIZE_MAX;
+}
+
+bool
+rerex_search(RerexMatcher* const   matcher,
+             const char* const     string,
+             const size_t          len,
+             const RerexSearchMode mode,
+             size_t* const         start,
+             size_t* const         end)
+{
+  size_t     s   = 0U;
+  size_t     e   = 0U;
+  const bool any = !start && !end;
+  const bool hit = search(matcher, string, len, 0U, mode, any, &s, &e);
+
+  if (hit && start) {
+    *start = s;
+  }
+
+  if (hit && end) {
+    *end = e;
+  }
+
+  return hit;
+}
+
+bool
+rerex_find_next(RerexMatcher* const   matcher,
+                const char* const     string,
+                const size_t          len,
+                const RerexSearchMode mode,
+                size_t* const         offset,
+                size_t* const         start,
+                size_t* const         end)
+{
+  if (!search(matcher, string, len, *offset, mode, false, start, end)) {
+    *offset = len + 1U;
+    return false;
+  }
+
+  // Continue after the match, or after its offset if it's empty
+  *offset = (*end > *start) ? *end : *end + 1U;
+  return true;
+}
+
+/* Pattern sets.
+
+   A set of patterns is matched in a single pass by merging them into one
+   automaton, which simply has the positions of every pattern side by side,
+   and the union of their start positions.  Each pattern keeps its own final
+   position, so which patterns match can be read from the active positions
+   after running the automaton, just like a stream.  The first position is an
+   unused placeholder, so the final position of a pattern isn't mistaken for
+   a final position of the whole set.  The complete and lazy DFAs only
+   distinguish accepting from non-accepting states, so sets are matched with
+   the bit-parallel or NFA simulation.
+
+   Patterns can be added and removed at any time, in time proportional to the
+   size of the pattern.  Adding a pattern appends its positions to arrays that
+   grow geometrically, and removing one only removes its start positions, so
+   its positions become unreachable garbage.  When most positions are garbage,
+   the arrays are compacted, which takes time proportional to the size of the
+   patterns removed since the last compaction.
+*/
+
+// Where the positions, follows, and character sets of a pattern in a set are
+typedef struct {
+  size_t first;       ///< Index of the first position, the final position
+  size_t n_positions; ///< Number of positions, or zero if removed
+  size_t follow;      ///< Offset of the first follow index
+  size_t n_follows;   ///< Number of follow indices
+  size_t set;         ///< Index of the first character set
+  size_t n_sets;      ///< Number of character sets
+} SetMember;
+
+struct RerexSetImpl {
+  RerexPattern pattern;            ///< Merged automaton of every pattern
+  SetMember*   members;            ///< Every pattern, indexed by ID
+  size_t       n_members;          ///< Number of IDs, including free ones
+  size_t*      free_ids;           ///< Stack of IDs of removed patterns
+  size_t       n_free_ids;         ///< Number of IDs of removed patterns
+  StateIndex*  starts;             ///< Start positions of every pattern
+  size_t       n_starts;           ///< Number of start positions
+  size_t*      start_slots;        ///< Index of each position in starts
+  size_t       n_follows;          ///< Number of follow indices in pattern
+  size_t       n_sets;             ///< Number of character sets in pattern
+  size_t       n_garbage;          ///< Number of unreachable positions
+  size_t       members_capacity;   ///< Capacity of members and free_ids
+  size_t       positions_capacity; ///< Capacity of position arrays
+  size_t       follows_capacity;   ///< Capacity of pattern follows
+  size_t       sets_capacity;      ///< Capacity of pattern sets
 };
 
-RerexMatcher*
-rerex_new_matcher(const RerexPattern* const regexp)
+// Return the number of character sets used by a pattern
+static size_t
+count_sets(const RerexPattern* const pattern)
+{
+  size_t n_sets = 0U;
+  for (size_t p = 0U; p < pattern->n_positions; ++p) {
+    const Position* const position = &pattern->positions[p];
+    if (position->min == REREX_CLASS && (size_t)position->max >= n_sets) {
+      n_sets = (size_t)position->max + 1U;
+    }
+  }
+
+  return n_sets;
+}
+
+// Grow the arrays of a set if necessary to fit the given number of elements
+static RerexStatus
+reserve_set(RerexSet* const set,
+            const size_t    n_positions,
+            const size_t    n_follows,
+            const size_t    n_sets)
+{
+  RerexPattern* const   merged    = &set->pattern;
+  RerexAllocator* const allocator = merged->allocator;
+
+  if (n_positions >= UINT32_MAX || n_follows >= UINT32_MAX) {
+    return REREX_NO_MEMORY; // Too many for 32-bit indices
+  }
+
+  if (n_positions > set->positions_capacity) {
+    const size_t capacity =
+      grow_capacity(set->positions_capacity, n_positions);
+
+    Position* const positions = (Position*)mem_realloc(
+      allocator, merged->positions, capacity * sizeof(Position));
+    if (positions) {
+      merged->positions = positions;
+    }
+
+    Label* const labels = (Label*)mem_realloc(
+      allocator, merged->labels, capacity * sizeof(Label));
+    if (labels) {
+      merged->labels = labels;
+    }
+
+    StateIndex* const starts = (StateIndex*)mem_realloc(
+      allocator, set->starts, capacity * sizeof(StateIndex));
+    if (starts) {
+      set->starts = starts;
+    }
+
+    size_t* const slots = (size_t*)mem_realloc(
+      allocator, set->start_slots, capacity * sizeof(size_t));
+    if (slots) {
+      set->start_slots = slots;
+    }
+
+    if (!positions || !labels || !starts || !slots) {
+      return REREX_NO_MEMORY;
+    }
+
+    set->positions_capacity = capacity;
+  }
+
+  if (n_follows > set->follows_capacity) {
+    const size_t capacity = grow_capacity(set->follows_capacity, n_follows);
+
+    StateIndex* const follows = (StateIndex*)mem_realloc(
+      allocator, merged->follows, capacity * sizeof(StateIndex));
+    if (!follows) {
+      return REREX_NO_MEMORY;
+    }
+
+    merged->follows       = follows;
+    set->follows_capacity = capacity;
+  }
+
+  if (n_sets > set->sets_capacity) {
+    const size_t   capacity = grow_capacity(set->sets_capacity, n_sets);
+    CharSet* const sets     = (CharSet*)mem_realloc(
+      allocator, merged->sets, capacity * sizeof(CharSet));
+    if (!sets) {
+      return REREX_NO_MEMORY;
+    }
+
+    merged->sets       = sets;
+    set->sets_capacity = capacity;
+  }
+
+  return REREX_SUCCESS;
+}
+
+// Reserve a pattern ID, reusing the ID of a removed pattern if possible
+static RerexStatus
+reserve_id(RerexSet* const set, size_t* const id)
 {
-  const size_t        n_states = regexp->states.n_states;
-  RerexMatcher* const m        = (RerexMatcher*)calloc(1, sizeof(RerexMatcher));
+  if (set->n_free_ids) {
+    *id = set->free_ids[--set->n_free_ids];
+    return REREX_SUCCESS;
+  }
 
-  if (m) {
-    m->regexp            = regexp;
-    m->active[0].indices = (StateIndex*)calloc(n_states, sizeof(StateIndex));
-    m->active[1].indices = (StateIndex*)calloc(n_states, sizeof(StateIndex));
-    m->last_active       = (size_t*)calloc(n_states, sizeof(size_t));
+  if (set->n_members == set->members_capacity) {
+    const size_t capacity =
+      grow_capacity(set->members_capacity, set->n_members + 1U);
+
+    SetMember* const members = (SetMember*)mem_realloc(
+      set->pattern.allocator, set->members, capacity * sizeof(SetMember));
+    if (members) {
+      set->members = members;
+    }
+
+    size_t* const free_ids = (size_t*)mem_realloc(
+      set->pattern.allocator, set->free_ids, capacity * sizeof(size_t));
+    if (free_ids) {
+      set->free_ids = free_ids;
+    }
+
+    if (!members || !free_ids) {
+      return REREX_NO_MEMORY;
+    }
+
+    set->members_capacity = capacity;
   }
 
-  return m;
+  *id = set->n_members++;
+  return REREX_SUCCESS;
+}
+
+// Set the bits for `p` in the bit-parallel tables of a set
+static void
+set_position_bits(RerexSet* const set, const StateIndex p)
+{
+  const RerexPattern* const merged   = &set->pattern;
+  const BitTable* const     bits     = &merged->bits;
+  const size_t              n_words  = bits->n_words;
+  const Position* const     position = &merged->positions[p];
+
+  for (unsigned c = 0U; c < 256U; ++c) {
+    if (accepts(merged, position, (char)c)) {
+      set_bit(bits->masks + (c * n_words), p);
+    }
+  }
+
+  for (size_t i = 0U; i < position->n_follow; ++i) {
+    set_bit(bits->follows + (p * n_words),
+            merged->follows[position->follow + i]);
+  }
+}
+
+/* Update the bit-parallel tables of a set after adding positions.
+
+   Positions from `first` and start positions from `first_start` are added
+   to the tables.  If the number of words in a set has changed, then the
+   tables are rebuilt from scratch, or disabled if there are too many
+   positions (or not enough memory) for them.
+*/
+static void
+update_bits(RerexSet* const set, size_t first, size_t first_start)
+{
+  RerexPattern* const   merged    = &set->pattern;
+  RerexAllocator* const allocator = merged->allocator;
+  BitTable* const       bits      = &merged->bits;
+  const size_t          n_words   = (merged->n_positions + 63U) / 64U;
+
+  if (n_words != bits->n_words || !first) {
+    // Reallocate the tables, with space for the maximum number of positions
+    const size_t n_follows = 64U * n_words * n_words;
+
+    mem_free(allocator, bits->follows);
+    mem_free(allocator, bits->masks);
+    memset(bits, 0, sizeof(BitTable));
+    if (n_words > MAX_WORDS) {
+      return;
+    }
+
+    bits->masks   = (Word*)mem_calloc(allocator, 256U * n_words, sizeof(Word));
+    bits->follows = (Word*)mem_calloc(allocator, n_follows, sizeof(Word));
+    if (!bits->masks || !bits->follows) {
+      mem_free(allocator, bits->follows);
+      mem_free(allocator, bits->masks);
+      memset(bits, 0, sizeof(BitTable));
+      return;
+    }
+
+    bits->n_words = n_words;
+    first         = 0U;
+    first_start   = 0U;
+  }
+
+  for (size_t p = first; p < merged->n_positions; ++p) {
+    set_position_bits(set, (StateIndex)p);
+  }
+
+  for (size_t i = first_start; i < set->n_starts; ++i) {
+    set_bit(bits->start, set->starts[i]);
+  }
+}
+
+RerexStatus
+rerex_set_add(RerexSet* const           set,
+              const RerexPattern* const pattern,
+              size_t* const             id)
+{
+  RerexPattern* const merged = &set->pattern;
+
+  // Count everything in the pattern to reserve space for it all at once
+  size_t n_follows = 0U;
+  for (size_t p = 0U; p < pattern->n_positions; ++p) {
+    n_follows += pattern->positions[p].n_follow;
+  }
+
+  const SetMember member = {merged->n_positions,
+                            pattern->n_positions,
+                            set->n_follows,
+                            n_follows,
+                            set->n_sets,
+                            count_sets(pattern)};
+
+  RerexStatus st = reserve_set(set,
+                               member.first + member.n_positions,
+                               member.follow + member.n_follows,
+                               member.set + member.n_sets);
+  if (st || (st = reserve_id(set, id))) {
+    return st;
+  }
+
+  // Copy the character sets
+  for (size_t i = 0U; i < member.n_sets; ++i) {
+    merged->sets[member.set + i] = pattern->sets[i];
+  }
+
+  // Copy every position, adjusting its set index, follows, and follow offset
+  for (size_t p = 0U; p < member.n_positions; ++p) {
+    const Position* const from = &pattern->positions[p];
+    Position* const       to   = &merged->positions[member.first + p];
+
+    *to        = *from;
+    to->follow = (StateIndex)set->n_follows;
+    if (from->min == REREX_CLASS) {
+      to->max = (Codepoint)(member.set + (size_t)from->max);
+    }
+
+    merged->labels[member.first + p] = pattern->labels[p];
+
+    for (size_t i = 0U; i < from->n_follow; ++i) {
+      merged->follows[set->n_follows++] =
+        (StateIndex)(member.first + pattern->follows[from->follow + i]);
+    }
+
+    set->start_slots[member.first + p] = SIZE_MAX;
+  }
+
+  // Add the start positions to the start list of the set
+  const size_t first_start = set->n_starts;
+  for (size_t i = 0U; i < pattern->n_start; ++i) {
+    const StateIndex p =
+      (StateIndex)(member.first + pattern->follows[pattern->start + i]);
+
+    set->start_slots[p]          = set->n_starts;
+    set->starts[set->n_starts++] = p;
+  }
+
+  set->members[*id] = member;
+  merged->n_positions += member.n_positions;
+  set->n_sets += member.n_sets;
+  update_bits(set, member.first, first_start);
+  return REREX_SUCCESS;
+}
+
+// Move every reachable position to the start of the arrays of a set
+static void
+compact_set(RerexSet* const set)
+{
+  RerexPattern* const   merged    = &set->pattern;
+  RerexAllocator* const allocator = merged->allocator;
+
+  Position* const positions = (Position*)mem_calloc(
+    allocator, set->positions_capacity, sizeof(Position));
+  Label* const labels =
+    (Label*)mem_calloc(allocator, set->positions_capacity, sizeof(Label));
+  StateIndex* const follows = (StateIndex*)mem_calloc(
+    allocator, set->follows_capacity, sizeof(StateIndex));
+  CharSet* const sets =
+    (CharSet*)mem_calloc(allocator, set->sets_capacity, sizeof(CharSet));
+  size_t* const slots =
+    (size_t*)mem_calloc(allocator, set->positions_capacity, sizeof(size_t));
+  if (!positions || !labels || !follows || !sets || !slots) {
+    mem_free(allocator, slots);
+    mem_free(allocator, sets);
+    mem_free(allocator, follows);
+    mem_free(allocator, labels);
+    mem_free(allocator, positions);
+    return; // Not compacting only wastes space
+  }
+
+  size_t n_positions = 1U;
+  size_t n_follows   = 0U;
+  size_t n_sets      = 0U;
+
+  positions[0] = merged->positions[0];
+  labels[0]    = merged->labels[0];
+  slots[0]     = set->start_slots[0];
+  for (size_t id = 0U; id < set->n_members; ++id) {
+    SetMember* const member = &set->members[id];
+    if (!member->n_positions) {
+      continue;
+    }
+
+    // Copy the sets, follows, and positions, adjusting all indices
+    if (member->n_sets) {
+      memcpy(sets + n_sets,
+             merged->sets + member->set,
+             member->n_sets * sizeof(CharSet));
+    }
+
+    for (size_t i = 0U; i < member->n_follows; ++i) {
+      follows[n_follows + i] = (StateIndex)(
+        merged->follows[member->follow + i] - member->first + n_positions);
+    }
+
+    for (size_t p = 0U; p < member->n_positions; ++p) {
+      const StateIndex      old_p = (StateIndex)(member->first + p);
+      const StateIndex      new_p = (StateIndex)(n_positions + p);
+      const Position* const from  = &merged->positions[old_p];
+      Position* const       to    = &positions[new_p];
+
+      *to        = *from;
+      to->follow = (StateIndex)(from->follow - member->follow + n_follows);
+      if (from->min == REREX_CLASS) {
+        to->max = (Codepoint)((size_t)from->max - member->set + n_sets);
+      }
+
+      labels[new_p] = merged->labels[old_p];
+
+      // Move the start slot to a new array, since IDs may be out of order
+      const size_t slot = set->start_slots[old_p];
+      slots[new_p]      = slot;
+      if (slot != SIZE_MAX) {
+        set->starts[slot] = new_p;
+      }
+    }
+
+    member->first  = n_positions;
+    member->follow = n_follows;
+    member->set    = n_sets;
+    n_positions += member->n_positions;
+    n_follows += member->n_follows;
+    n_sets += member->n_sets;
+  }
+
+  mem_free(allocator, set->start_slots);
+  mem_free(allocator, merged->sets);
+  mem_free(allocator, merged->follows);
+  mem_free(allocator, merged->labels);
+  mem_free(allocator, merged->positions);
+  set->start_slots    = slots;
+  merged->positions   = positions;
+  merged->labels      = labels;
+  merged->n_positions = n_positions;
+  merged->follows     = follows;
+  merged->sets        = sets;
+  set->n_follows      = n_follows;
+  set->n_sets         = n_sets;
+  set->n_garbage      = 0U;
+  update_bits(set, 0U, 0U);
+}
+
+bool
+rerex_set_remove(RerexSet* const set, const size_t id)
+{
+  if (id >= set->n_members || !set->members[id].n_positions) {
+    return false;
+  }
+
+  RerexPattern* const merged = &set->pattern;
+  SetMember* const    member = &set->members[id];
+  BitTable* const     bits   = &merged->bits;
+  const size_t        end    = member->first + member->n_positions;
+
+  // Remove the start positions of the pattern, so none of it is reachable
+  for (size_t p = member->first; p < end; ++p) {
+    const size_t slot = set->start_slots[p];
+    if (slot != SIZE_MAX) {
+      const StateIndex last = set->starts[--set->n_starts];
+
+      set->starts[slot]      = last;
+      set->start_slots[last] = slot;
+      set->start_slots[p]    = SIZE_MAX;
+      if (bits->n_words) {
+        bits->start[p / 64U] &= ~((Word)1U << (p % 64U));
+      }
+    }
+  }
+
+  set->n_garbage += member->n_positions;
+  member->n_positions              = 0U;
+  set->free_ids[set->n_free_ids++] = id;
+
+  if (set->n_garbage > merged->n_positions / 2U) {
+    compact_set(set);
+  }
+
+  return true;
+}
+
+RerexSet*
+rerex_new_set(const RerexPattern* const* const patterns,
+              const size_t                     n_patterns)
+{
+  return rerex_new_set_alloc(NULL, patterns, n_patterns);
+}
+
+RerexSet*
+rerex_new_set_alloc(RerexAllocator* const            allocator,
+                    const RerexPattern* const* const patterns,
+                    const size_t                     n_patterns)
+{
+  RerexAllocator* const a   = get_allocator(allocator);
+  RerexSet* const       set = (RerexSet*)mem_calloc(a, 1, sizeof(RerexSet));
+  if (!set) {
+    return NULL;
+  }
+
+  set->pattern.allocator = a;
+
+  // Add the unused first position
+  if (reserve_set(set, 1U, 0U, 0U)) {
+    rerex_free_set(set);
+    return NULL;
+  }
+
+  const Position placeholder = {REREX_MATCH, 0, 0U, 0U};
+  const Label    empty       = {UINT8_MAX, 0U};
+
+  set->pattern.positions[0] = placeholder;
+  set->pattern.labels[0]    = empty;
+  set->pattern.n_positions  = 1U;
+  set->pattern.max_length   = SIZE_MAX;
+  set->pattern.reason       = "pattern sets are always simulated";
+  set->start_slots[0]       = SIZE_MAX;
+  update_bits(set, 0U, 0U);
+
+  // Add every pattern, so each has its index as its ID
+  for (size_t i = 0U; i < n_patterns; ++i) {
+    size_t id = 0U;
+    if (rerex_set_add(set, patterns[i], &id)) {
+      rerex_free_set(set);
+      return NULL;
+    }
+  }
+
+  return set;
 }
 
 void
-rerex_free_matcher(RerexMatcher* const matcher)
+rerex_free_set(RerexSet* const set)
+{
+  if (set) {
+    RerexAllocator* const allocator = set->pattern.allocator;
+
+    clear_pattern(&set->pattern);
+    mem_free(allocator, set->start_slots);
+    mem_free(allocator, set->starts);
+    mem_free(allocator, set->free_ids);
+    mem_free(allocator, set->members);
+    mem_free(allocator, set);
+  }
+}
+
+RerexMatcher*
+rerex_new_set_matcher(const RerexSet* const set)
 {
+  RerexMatcher* const matcher = rerex_new_matcher(&set->pattern);
   if (matcher) {
-    free(matcher->last_active);
-    free(matcher->active[1].indices);
-    free(matcher->active[0].indices);
-    free(matcher);
+    matcher->set = set;
+    rerex_matcher_reset(matcher);
   }
+
+  return matcher;
 }
 
-// Add `s` and any epsilon successors to the active list
+// Enter the start positions of every pattern in the set of a matcher
 static void
-enter_state(RerexMatcher* const matcher,
-            const size_t        step,
-            IndexList* const    list,
-            const StateIndex    s)
+enter_set_start(RerexMatcher* const matcher)
 {
-  const StateArray* const states = &matcher->regexp->states;
+  const RerexSet* const set = matcher->set;
 
-  if (s && matcher->last_active[s] != step) {
-    matcher->last_active[s] = step;
+  enter_follows(matcher, 0U, &matcher->active[0], set->starts, set->n_starts);
+}
 
-    const State* const state = &states->states[s];
-    if (state->min == REREX_SPLIT) {
-      enter_state(matcher, step, list, state->next1);
-      enter_state(matcher, step, list, state->next2);
-    } else {
-      list->indices[list->n_indices++] = s;
+// Grow the arrays of a matcher if its set has grown since they were allocated
+static bool
+fit_matcher(RerexMatcher* const matcher)
+{
+  const size_t n = matcher->regexp->n_positions;
+  if (n <= matcher->capacity) {
+    return true;
+  }
+
+  bool ok = true;
+  for (unsigned i = 0U; i < 2U; ++i) {
+    StateIndex* const indices = (StateIndex*)mem_realloc(
+      matcher->allocator, matcher->active[i].indices, n * sizeof(StateIndex));
+    if (indices) {
+      matcher->active[i].indices = indices;
+    }
+
+    size_t* const origins = (size_t*)mem_realloc(
+      matcher->allocator, matcher->origins[i], n * sizeof(size_t));
+    if (origins) {
+      matcher->origins[i] = origins;
+    }
+
+    ok = ok && indices && origins;
+  }
+
+  size_t* const last_active = (size_t*)mem_realloc(
+    matcher->allocator, matcher->last_active, n * sizeof(size_t));
+  if (last_active) {
+    // Clear the new entries, which are never entered at a current step
+    for (size_t i = matcher->capacity; i < n; ++i) {
+      last_active[i] = 0U;
     }
+
+    matcher->last_active = last_active;
+  }
+
+  if (ok && last_active) {
+    matcher->capacity = n;
+    return true;
   }
+
+  return false;
 }
 
-bool
-rerex_match(RerexMatcher* const matcher, const char* const string)
+// Return whether the final position `f` is active at the end of the stream
+static bool
+stream_entered(const RerexMatcher* const matcher, const size_t f)
 {
-  const StateArray* const states = &matcher->regexp->states;
+  const Stream* const stream = &matcher->stream;
 
-  // Reset matcher to a consistent initial state
-  matcher->active[0].n_indices = 0;
-  matcher->active[1].n_indices = 0;
-  for (size_t i = 0; i < states->n_states; ++i) {
-    matcher->last_active[i] = SIZE_MAX;
+  return matcher->regexp->bits.n_words
+           ? (stream->bits[f / 64U] >> (f % 64U)) & 1U
+           : entered(matcher, (StateIndex)f, stream->n_bytes);
+}
+
+// Run a set matcher on a string, and return false if no pattern matches
+static bool
+run_set(RerexMatcher* const matcher, const char* const string, const size_t len)
+{
+  if (!fit_matcher(matcher)) {
+    return false;
   }
 
-  // Enter start state
-  enter_state(matcher, 0, &matcher->active[0], matcher->regexp->start);
+  rerex_matcher_reset(matcher);
+  return rerex_matcher_feed(matcher, string, len) != REREX_DEAD;
+}
+
+size_t
+rerex_set_match(RerexMatcher* const matcher,
+                const char* const   string,
+                const size_t        len,
+                size_t* const       ids)
+{
+  const RerexSet* const set     = matcher->set;
+  size_t                n_found = 0U;
+
+  if (run_set(matcher, string, len)) {
+    for (size_t id = 0U; id < set->n_members; ++id) {
+      const SetMember* const member = &set->members[id];
+      if (member->n_positions && stream_entered(matcher, member->first)) {
+        ids[n_found++] = id;
+      }
+    }
+  }
 
-  // Tick the matcher for every input character
-  bool phase = false;
-  for (size_t i = 0; string[i]; ++i) {
-    const char       c         = string[i];
-    IndexList* const list      = &matcher->active[phase];
-    IndexList* const next_list = &matcher->active[!phase];
+  rerex_matcher_reset(matcher);
+  return n_found;
+}
 
-    // Add successor states to the next iteration's list
-    next_list->n_indices = 0;
-    for (size_t j = 0; j < list->n_indices; ++j) {
-      const State* const state = &states->states[list->indices[j]];
-      if (state->min <= c && c <= state->max) {
-        enter_state(matcher, i + 1, next_list, state->next1);
+size_t
+rerex_set_match_first(RerexMatcher* const matcher,
+                      const char* const   string,
+                      const size_t        len)
+{
+  const RerexSet* const set   = matcher->set;
+  size_t                first = SIZE_MAX;
+
+  if (run_set(matcher, string, len)) {
+    for (size_t id = 0U; id < set->n_members && first == SIZE_MAX; ++id) {
+      const SetMember* const member = &set->members[id];
+      if (member->n_positions && stream_entered(matcher, member->first)) {
+        first = id;
       }
     }
+  }
 
-    // Flip phase to swap active lists
-    phase = !phase;
+  rerex_matcher_reset(matcher);
+  return first;
+}
+
+/* DFA compilation.
+
+   The complete DFA is built by subset construction using the same machinery
+   as the lazy DFA, except the storage grows as necessary up to the limit
+   instead of being flushed.  Transitions are computed by visiting every state
+   in the order it was added, so the states form a worklist.
+*/
+
+// Add the state for the first active list to a DFA being built
+static RerexStatus
+build_dfa_state(RerexMatcher* const matcher,
+                const size_t        limit,
+                DfaIndex* const     out)
+{
+  const size_t           n_positions = matcher->regexp->n_positions;
+  Dfa* const             dfa         = &matcher->dfa;
+  const IndexList* const list        = &matcher->active[0];
+
+  if ((*out = dfa_intern_list(dfa, list))) {
+    return REREX_SUCCESS;
+  }
+
+  if (dfa->n_dstates >= limit) {
+    return REREX_TOO_MANY_STATES;
+  }
+
+  // Double the number of states (up to the limit), and the pool if necessary
+  const size_t max_dstates = dfa->max_dstates * 2U;
+  const size_t capacity    = dfa->pool_capacity;
+  const bool   full_pool   = capacity - dfa->pool_size < n_positions;
+  RerexStatus  st          = dfa_resize(matcher->allocator,
+                                dfa,
+                                max_dstates < limit ? max_dstates : limit,
+                                full_pool ? capacity * 2U : capacity);
+
+  if (!st) {
+    *out = dfa_intern_list(dfa, list);
+  }
+
+  return st;
+}
+
+// Build a complete DFA in the cache of `matcher` by subset construction
+static RerexStatus
+build_dfa(RerexMatcher* const matcher, const size_t limit)
+{
+  const RerexPattern* const pattern   = matcher->regexp;
+  const size_t              n_classes = pattern->n_classes;
+  Dfa* const                dfa       = &matcher->dfa;
+  size_t                    step      = 0U;
+  char                      reps[256] = {0};
+
+  // Find the first byte in every class to use as a representative
+  for (unsigned i = 0U; i < 256U; ++i) {
+    const unsigned c = 255U - i;
+
+    reps[pattern->classes[c]] = (char)c;
+  }
+
+  // Allocate room for the dead state and add it along with the start state
+  reset_matcher(matcher);
+  dfa->n_classes = n_classes;
+  RerexStatus st =
+    dfa_resize(matcher->allocator, dfa, 2U, pattern->n_positions);
+  if (st || limit < 2U) {
+    return st ? st : REREX_TOO_MANY_STATES;
+  }
+
+  dfa_flush(dfa);
+  enter_start(matcher, 0U);
+  st = build_dfa_state(matcher, limit, &dfa->start);
+
+  // Compute every transition of every state, which may add new states
+  for (size_t s = 1U; !st && s < dfa->n_dstates; ++s) {
+    for (size_t k = 0U; !st && k < n_classes; ++k) {
+      DfaIndex next = 0U;
+
+      dfa_successors(matcher, (DfaIndex)s, reps[k], ++step);
+      if (!(st = build_dfa_state(matcher, limit, &next))) {
+        dfa->next[(s * n_classes) + k] = next;
+      }
+    }
+  }
+
+  return st;
+}
+
+RerexStatus
+rerex_compile_dfa(RerexPattern* const pattern, const size_t max_states)
+{
+  RerexMatcher* const matcher = rerex_new_matcher(pattern);
+  if (!matcher) {
+    return REREX_NO_MEMORY;
+  }
+
+  // Limit the number of states including the unused zero
+  const size_t limit = max_states < (size_t)INT32_MAX ? max_states + 1U
+                                                      : (size_t)INT32_MAX;
+
+  RerexAllocator* const allocator = pattern->allocator;
+  Dfa* const            dfa       = &matcher->dfa;
+  RerexStatus           st        = build_dfa(matcher, limit);
+  bool* const           acc =
+    st ? NULL : (bool*)mem_calloc(allocator, dfa->n_dstates, sizeof(bool));
+  if (!st && !acc) {
+    st = REREX_NO_MEMORY;
   }
 
-  // Check if match state is entered in the end
-  const IndexList* const active = &matcher->active[phase];
-  for (size_t i = 0; i < active->n_indices; ++i) {
-    if (states->states[active->indices[i]].min == REREX_MATCH) {
-      return true;
+  if (!st) {
+    // Replace any existing DFA by moving the table from the builder
+    mem_free(allocator, pattern->dfa.accepting);
+    mem_free(allocator, pattern->dfa.next);
+    for (size_t s = 1U; s < dfa->n_dstates; ++s) {
+      acc[s] = dfa->dstates[s].accepting;
     }
+
+    // Move the table to the pattern, shrinking it to fit
+    const size_t size = dfa->n_dstates * dfa->n_classes * sizeof(DfaIndex);
+
+    pattern->dfa.next      = (DfaIndex*)mem_shrink(allocator, dfa->next, size);
+    pattern->dfa.accepting = acc;
+    pattern->dfa.n_dstates = dfa->n_dstates;
+    pattern->dfa.start     = dfa->start;
+    pattern->dfa.dead      = dfa->dead;
+    pattern->engine        = REREX_ENGINE_DFA;
+    pattern->reason        = "DFA built by rerex_compile_dfa()";
+    dfa->next              = NULL;
   }
 
-  return false;
+  rerex_free_matcher(matcher);
+  return st;
+}
+
+/* Engine planning.
+
+   Every pattern is matched by one of a few engines, chosen when it's
+   compiled from what is already known about it, so planning is cheap.  A
+   pattern that matches only a single string is simply compared with it.  A
+   complete DFA is fastest, but its size can be exponential in the number of
+   positions, so one is only built for small patterns with few byte classes,
+   and construction is abandoned if the number of states grows much larger
+   than the number of positions.  A DFA also isn't worth building if literals
+   make up most of every match, since the literal checks do most of the work.
+   Other patterns are simulated, with bit sets if there are few enough
+   positions, where matchers with a cache build a lazy DFA instead.
+*/
+
+// Maximum number of positions in a pattern to build a DFA for automatically
+#define PLAN_DFA_POSITIONS 32U
+
+// Maximum number of byte classes in a pattern to build a DFA for
+#define PLAN_DFA_CLASSES 32U
+
+// Maximum number of DFA states per position, beyond which it's blowing up
+#define PLAN_STATES_PER_POSITION 4U
+
+// Memory for the table of a complete DFA that is built automatically
+#define PLAN_DFA_BYTES 16384U
+
+// Maximum number of states in a DFA forced with REREX_FORCE_DFA
+#define FORCED_DFA_STATES 4096U
+
+// Return whether the only string that matches a pattern is its prefix
+static bool
+is_literal(const RerexPattern* const pattern)
+{
+  return pattern->prefix_len == pattern->min_length &&
+         pattern->min_length == pattern->max_length;
+}
+
+// Return whether literals make up at least half of the longest match
+static bool
+is_mostly_literal(const RerexPattern* const pattern)
+{
+  const size_t literal_len = pattern->prefix_len + pattern->suffix_len;
+  const size_t covered =
+    literal_len < pattern->min_length ? literal_len : pattern->min_length;
+
+  return pattern->max_length < SIZE_MAX && covered >= pattern->max_length / 2U;
+}
+
+// Choose the engine for a newly compiled pattern, and build what it needs
+static RerexStatus
+plan_engine(RerexPattern* const pattern, const RerexFlags flags)
+{
+  pattern->engine = REREX_ENGINE_NFA;
+
+  if (flags & REREX_FORCE_NFA) {
+    pattern->reason = "forced by REREX_FORCE_NFA";
+    return REREX_SUCCESS;
+  }
+
+  if (flags & REREX_FORCE_BITS) {
+    pattern->engine = REREX_ENGINE_BITS;
+    pattern->reason = "forced by REREX_FORCE_BITS";
+    return pattern->bits.n_words ? REREX_SUCCESS : REREX_TOO_MANY_STATES;
+  }
+
+  if (flags & REREX_FORCE_DFA) {
+    const RerexStatus st = rerex_compile_dfa(pattern, FORCED_DFA_STATES);
+
+    pattern->reason = "forced by REREX_FORCE_DFA";
+    return st;
+  }
+
+  if (is_literal(pattern)) {
+    pattern->engine = REREX_ENGINE_LITERAL;
+    pattern->reason = "pattern only matches a literal string";
+    return REREX_SUCCESS;
+  }
+
+  if (!pattern->bits.n_words) {
+    pattern->reason = "too many positions for bit sets";
+    return REREX_SUCCESS;
+  }
+
+  pattern->engine = REREX_ENGINE_BITS;
+  if (is_mostly_literal(pattern)) {
+    pattern->reason = "literals make up most of every match";
+    return REREX_SUCCESS;
+  }
+
+  if (pattern->n_positions > PLAN_DFA_POSITIONS ||
+      pattern->n_classes > PLAN_DFA_CLASSES) {
+    pattern->reason = "too large to build a DFA ahead of time";
+    return REREX_SUCCESS;
+  }
+
+  // Try to build a DFA, stopping if it outgrows the positions or the budget
+  const size_t row_size = pattern->n_classes * sizeof(DfaIndex);
+  const size_t by_size  = PLAN_DFA_BYTES / row_size;
+  const size_t by_count = PLAN_STATES_PER_POSITION * pattern->n_positions;
+  const size_t limit    = by_size < by_count ? by_size : by_count;
+
+  const RerexStatus st = rerex_compile_dfa(pattern, limit);
+  if (st == REREX_TOO_MANY_STATES) {
+    pattern->reason = "DFA has many more states than positions";
+    return REREX_SUCCESS;
+  }
+
+  pattern->reason = "DFA is small enough to build ahead of time";
+  return st;
 }
@@ -9,6 +9,8 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 typedef struct {
   uintptr_t   match;   ///< Boolean, true if text should match
@@ -79,6 +81,13 @@ static const MatchTestCase match_tests[] = {
   {0, "[^b-d]", "b"},
   {0, "[^b-d]", "d"},
   {1, "[^b-d]", "e"},
+  {0, "[^bd]", "b"},
+  {1, "[^bd]", "c"},
+  {0, "[^bd]", "d"},
+  {0, "[^a-cx-z]", "b"},
+  {1, "[^a-cx-z]", "m"},
+  {0, "[^a-cx-z]", "y"},
+  {0, "[^ -~]", "a"},
   {0, "[^ -/]", "\t"},
   {1, "[^ -/]", "0"},
   {1, "[^{-~]", "z"},
@@ -196,6 +205,1265 @@ static const MatchTestCase match_tests[] = {
   {1, "(a|b)*c|(a|ab)*c", "abc"},
 };
 
+// Write `prefix` then `n` copies of `unit` to `buf`, for a long pattern
+static char*
+make_long_pattern(char* const       buf,
+                  const size_t      size,
+                  const char* const prefix,
+                  const char* const unit,
+                  const size_t      n)
+{
+  const size_t prefix_len = strlen(prefix);
+  const size_t unit_len   = strlen(unit);
+
+  assert(prefix_len + (n * unit_len) < size);
+
+  memcpy(buf, prefix, prefix_len);
+  for (size_t i = 0U; i < n; ++i) {
+    memcpy(buf + prefix_len + (i * unit_len), unit, unit_len);
+  }
+
+  buf[prefix_len + (n * unit_len)] = '\0';
+  return buf;
+}
+
+// Test that matching with a small lazy DFA cache works when it overflows
+static void
+test_cache(void)
+{
+  // A pattern with exponentially many DFA states, and inputs to explore them
+  static const char* const regexp = "(a|b)*a(a|b)(a|b)(a|b)(a|b)";
+  static const char* const texts[] = {
+    "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+    "abbabaabbbaababbbbaaaabbababbabbbabaaabaabbaabbbaaabbbbbbaaaaabbabbbab",
+    "ababab",
+    "aababbabbbabbbb",
+    "bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbba",
+    "",
+  };
+
+  RerexPattern*     pattern = NULL;
+  size_t            end     = 0;
+  const RerexStatus st =
+    rerex_compile_flags(regexp, REREX_FORCE_BITS, &end, &pattern);
+
+  assert(!st);
+
+  RerexMatcher* const nfa  = rerex_new_matcher(pattern);
+  RerexMatcher* const lazy = rerex_new_matcher(pattern);
+
+  // Sizes which disable the cache, make it thrash, make it flush, and fit
+  static const size_t sizes[] = {0U, 1U, 1024U, 2048U, 65536U};
+
+  for (size_t s = 0U; s < sizeof(sizes) / sizeof(*sizes); ++s) {
+    assert(!rerex_set_cache_size(lazy, sizes[s]));
+
+    for (unsigned r = 0U; r < 3U; ++r) {
+      for (size_t t = 0U; t < sizeof(texts) / sizeof(*texts); ++t) {
+        assert(rerex_match(lazy, texts[t]) == rerex_match(nfa, texts[t]));
+      }
+    }
+  }
+
+  rerex_free_matcher(lazy);
+  rerex_free_matcher(nfa);
+  rerex_free_pattern(pattern);
+}
+
+// Test a tiny lazy DFA cache which fills up again after being flushed
+static void
+test_cache_refill(void)
+{
+  // A pattern whose start state is never reached again after the first byte
+  static const char* const regexp = "[ab](a|b)*a(a|b)(a|b)(a|b)(a|b)";
+
+  RerexPattern* pattern = NULL;
+  size_t        end     = 0;
+
+  assert(!rerex_compile_flags(regexp, REREX_FORCE_NFA, &end, &pattern));
+
+  RerexMatcher* const nfa  = rerex_new_matcher(pattern);
+  RerexMatcher* const lazy = rerex_new_matcher(pattern);
+  char                text[48];
+
+  for (size_t size = 600U; size <= 1000U; size += 100U) {
+    assert(!rerex_set_cache_size(lazy, size));
+
+    // Runs of b to build up cache hits, then every tail of a and b
+    for (unsigned i = 0U; i < 1024U; ++i) {
+      const size_t n_b = 8U + (i % 32U);
+
+      memset(text, 'b', n_b);
+      for (size_t j = 0U; j < 6U; ++j) {
+        text[n_b + j] = ((i >> j) & 1U) ? 'a' : 'b';
+      }
+
+      text[n_b + 6U] = '\0';
+      assert(rerex_match(lazy, text) == rerex_match(nfa, text));
+    }
+  }
+
+  rerex_free_matcher(lazy);
+  rerex_free_matcher(nfa);
+  rerex_free_pattern(pattern);
+}
+
+typedef struct {
+  const char* pattern; ///< Regular expression
+  const char* prefix;  ///< Literal prefix of every match
+  const char* suffix;  ///< Literal suffix of every match
+} LiteralTestCase;
+
+static const LiteralTestCase literal_tests[] = {
+  {"a", "a", "a"},
+  {"abc", "abc", "abc"},
+  {"a*", "", ""},
+  {"a+", "a", "a"},
+  {"ab?", "a", ""},
+  {"a?b", "", "b"},
+  {"a|a", "a", "a"},
+  {"a|b", "", ""},
+  {"(a)+a", "aa", "aa"},
+  {"(ab|ac)d", "a", "d"},
+  {"a(b|c)*", "a", ""},
+  {"(a|b)c", "", "c"},
+  {"[.]com", ".com", ".com"},
+  {"[^ -~]", "", ""},
+  {"P[0-9]+Y", "P", "Y"},
+  {"--(0[1-9]|1[0-2])(Z|[-+][0-2][0-9]:[0-5][0-9])?", "--", ""},
+};
+
+typedef struct {
+  const char* pattern;    ///< Regular expression
+  size_t      min_length; ///< Length of the shortest match
+  size_t      max_length; ///< Length of the longest match
+} LengthTestCase;
+
+static const LengthTestCase length_tests[] = {
+  {"a", 1U, 1U},
+  {"abc", 3U, 3U},
+  {"a?", 0U, 1U},
+  {"a*", 0U, SIZE_MAX},
+  {"a+", 1U, SIZE_MAX},
+  {"a|bcd", 1U, 3U},
+  {"(ab?)(cd)?", 1U, 4U},
+  {"a(b|c)*d", 2U, SIZE_MAX},
+  {"-?[0-9][0-9][0-9][0-9]", 4U, 5U},
+  {"[0-9][0-9][0-9][0-9]-[0-9][0-9]-[0-9][0-9]", 10U, 10U},
+};
+
+// Test that the shortest and longest match lengths of patterns are found
+static void
+test_lengths(void)
+{
+  const size_t n_tests = sizeof(length_tests) / sizeof(*length_tests);
+
+  for (size_t i = 0U; i < n_tests; ++i) {
+    RerexPattern* pattern = NULL;
+    size_t        end     = 0;
+
+    assert(!rerex_compile(length_tests[i].pattern, &end, &pattern));
+    assert(rerex_min_length(pattern) == length_tests[i].min_length);
+    assert(rerex_max_length(pattern) == length_tests[i].max_length);
+
+    rerex_free_pattern(pattern);
+  }
+}
+
+// Test matching strings with an explicit length
+static void
+test_match_n(void)
+{
+  RerexPattern* pattern = NULL;
+  size_t        end     = 0;
+
+  assert(!rerex_compile("-?[0-9][0-9][0-9][0-9]", &end, &pattern));
+
+  RerexMatcher* const matcher = rerex_new_matcher(pattern);
+
+  assert(rerex_match_n(matcher, "2021", 4U));
+  assert(rerex_match_n(matcher, "-2021", 5U));
+  assert(rerex_match_n(matcher, "2021-12-31", 4U));
+  assert(!rerex_match_n(matcher, "2021", 3U));
+  assert(!rerex_match_n(matcher, "-2021-12-31", 6U));
+  assert(!rerex_match_n(matcher, "", 0U));
+
+  rerex_free_matcher(matcher);
+  rerex_free_pattern(pattern);
+}
+
+// Check that batch results match the results of matching each string alone
+static void
+check_batch(const char* const regexp)
+{
+  static const char* const texts[] = {
+    "", "c", "abc", "xxbac", "xcd", "cdd", "abd", "c", "cddddd", "ab", "c",
+  };
+
+  const size_t n_texts = sizeof(texts) / sizeof(*texts);
+
+  RerexPattern* pattern = NULL;
+  size_t        end     = 0;
+
+  assert(!rerex_compile_flags(regexp, REREX_FORCE_NFA, &end, &pattern));
+
+  RerexMatcher* const matcher = rerex_new_matcher(pattern);
+
+  RerexStringView views[16]        = {{NULL, 0U}};
+  int32_t         offsets[17]      = {0};
+  char            data[64]         = {0};
+  uint8_t         results[2]       = {0xFFU, 0xFFU};
+  uint8_t         arrow_results[2] = {0xFFU, 0xFFU};
+
+  for (size_t i = 0U; i < n_texts; ++i) {
+    const size_t len = strlen(texts[i]);
+
+    views[i].data  = texts[i];
+    views[i].len   = len;
+    offsets[i + 1] = offsets[i] + (int32_t)len;
+    memcpy(data + offsets[i], texts[i], len);
+  }
+
+  rerex_match_batch(matcher, views, n_texts, results);
+  rerex_match_offsets(matcher, data, offsets, n_texts, arrow_results);
+
+  for (size_t i = 0U; i < n_texts; ++i) {
+    const bool match = rerex_match(matcher, texts[i]);
+    const bool bit   = (results[i / 8U] >> (i % 8U)) & 1;
+
+    assert(bit == match);
+    assert(((arrow_results[i / 8U] >> (i % 8U)) & 1) == bit);
+  }
+
+  // Check that unused bits are cleared, and that an empty batch writes nothing
+  assert(!(results[1] >> (n_texts % 8U)));
+  assert(results[0] == arrow_results[0] && results[1] == arrow_results[1]);
+  rerex_match_batch(matcher, NULL, 0U, NULL);
+  rerex_match_offsets(matcher, data, offsets, 0U, NULL);
+
+  // Match again with a lazy DFA
+  uint8_t lazy_results[2] = {0U, 0U};
+  assert(!rerex_set_cache_size(matcher, 4096U));
+  rerex_match_batch(matcher, views, n_texts, lazy_results);
+  assert(!memcmp(lazy_results, results, sizeof(results)));
+
+  // Match again with a complete DFA, which matches groups in lockstep
+  uint8_t dfa_results[2] = {0U, 0U};
+  assert(!rerex_compile_dfa(pattern, 4096U));
+  rerex_match_batch(matcher, views, n_texts, dfa_results);
+  assert(!memcmp(dfa_results, results, sizeof(results)));
+  rerex_match_offsets(matcher, data, offsets, n_texts, dfa_results);
+  assert(!memcmp(dfa_results, results, sizeof(results)));
+
+  rerex_free_matcher(matcher);
+  rerex_free_pattern(pattern);
+}
+
+// Test matching a batch of strings with every engine
+static void
+test_batch(void)
+{
+  char long_regexp[1024];
+
+  check_batch("x*(a|b)*c");
+  check_batch("x*(a|b)*cd*");
+  check_batch(make_long_pattern(
+    long_regexp, sizeof(long_regexp), "x*(a|b)*c", "d?", 260U));
+}
+
+// Run tasks in reverse order, cycling through workers like a thread pool would
+static void
+reverse_executor(void* const     context,
+                 const size_t    n_workers,
+                 const size_t    n_tasks,
+                 const RerexTask task,
+                 void* const     data)
+{
+  size_t* const n_calls = (size_t*)context;
+
+  for (size_t i = 0U; i < n_tasks; ++i) {
+    task(data, i % n_workers, n_tasks - 1U - i);
+    ++*n_calls;
+  }
+}
+
+// Test matching a batch of strings in parallel chunks
+static void
+test_parallel(void)
+{
+  static const char* const texts[] = {"abc", "c", "x", "", "bac", "abd", "cc"};
+
+  enum { n_strings = 1500 };
+
+  RerexPattern* pattern = NULL;
+  size_t        end     = 0;
+
+  assert(!rerex_compile("x*(a|b)*c", &end, &pattern));
+
+  RerexMatcher* const matcher = rerex_new_matcher(pattern);
+  RerexStringView     views[n_strings];
+  uint8_t             serial[(n_strings + 7) / 8]   = {0};
+  uint8_t             parallel[(n_strings + 7) / 8] = {0};
+  size_t              n_calls                       = 0U;
+
+  for (size_t i = 0U; i < n_strings; ++i) {
+    views[i].data = texts[i % 7U];
+    views[i].len  = strlen(texts[i % 7U]);
+  }
+
+  rerex_match_batch(matcher, views, n_strings, serial);
+
+  // Match with an executor, which is called with 24 chunks of up to 64
+  assert(!rerex_match_parallel(
+    pattern, views, n_strings, parallel, 8U, reverse_executor, &n_calls));
+  assert(n_calls == 24U);
+  assert(!memcmp(parallel, serial, sizeof(serial)));
+
+  // Match on the calling thread without an executor
+  memset(parallel, 0, sizeof(parallel));
+  assert(!rerex_match_parallel(pattern, views, n_strings, parallel, 8U, NULL,
+                               NULL));
+  assert(!memcmp(parallel, serial, sizeof(serial)));
+
+  // Match nothing, which doesn't call the executor
+  assert(!rerex_match_parallel(
+    pattern, views, 0U, NULL, 8U, reverse_executor, &n_calls));
+  assert(n_calls == 24U);
+
+  // Match a small batch, which is still split between every worker
+  uint8_t small_serial[(300 + 7) / 8]   = {0};
+  uint8_t small_parallel[(300 + 7) / 8] = {0};
+
+  n_calls = 0U;
+  rerex_match_batch(matcher, views, 300U, small_serial);
+  assert(!rerex_match_parallel(
+    pattern, views, 300U, small_parallel, 4U, reverse_executor, &n_calls));
+  assert(n_calls == 5U);
+  assert(!memcmp(small_parallel, small_serial, sizeof(small_serial)));
+
+  // Match with a single worker, which still gets 4 chunks of 384
+  memset(parallel, 0, sizeof(parallel));
+  n_calls = 0U;
+  assert(!rerex_match_parallel(
+    pattern, views, n_strings, parallel, 1U, reverse_executor, &n_calls));
+  assert(n_calls == 4U);
+  assert(!memcmp(parallel, serial, sizeof(serial)));
+
+  rerex_free_matcher(matcher);
+  rerex_free_pattern(pattern);
+}
+
+// Match a long string in chunks, and check that it matches like rerex_match_n()
+static void
+check_chunked(RerexPattern* const pattern,
+              const char* const   string,
+              const size_t        len)
+{
+  RerexMatcher* const matcher  = rerex_new_matcher(pattern);
+  const bool          expected = rerex_match_n(matcher, string, len);
+  size_t              n_calls  = 0U;
+  bool                match    = !expected;
+
+  assert(!rerex_match_chunked(
+    pattern, string, len, 4U, reverse_executor, &n_calls, &match));
+  assert(match == expected);
+
+  match = !expected;
+  assert(!rerex_match_chunked(pattern, string, len, 4U, NULL, NULL, &match));
+  assert(match == expected);
+
+  rerex_free_matcher(matcher);
+}
+
+// Test matching a single long string in parallel chunks
+static void
+test_chunked(void)
+{
+  enum { len = 20002 };
+
+  static char string[len + 1];
+
+  RerexPattern* pattern = NULL;
+  size_t        end     = 0;
+
+  assert(!rerex_compile_flags("(ab|cd)*e?", REREX_FORCE_BITS, &end, &pattern));
+
+  // Chunks are an odd length, so some split a pair in two
+  for (size_t i = 0U; i < len; i += 2U) {
+    string[i]      = (i % 6U) ? 'a' : 'c';
+    string[i + 1U] = (i % 6U) ? 'b' : 'd';
+  }
+
+  // Match with the NFA, then with a complete DFA
+  for (unsigned i = 0U; i < 2U; ++i) {
+    check_chunked(pattern, string, len);
+    check_chunked(pattern, string, 6U);
+    check_chunked(pattern, string, len - 1U);
+
+    string[len - 1U] = 'e';
+    check_chunked(pattern, string, len);
+    string[len - 1U] = 'b';
+
+    string[len / 2U] = 'x';
+    check_chunked(pattern, string, len);
+    string[len / 2U] = 'a';
+
+    check_chunked(pattern, "x", 1U);
+    assert(!rerex_compile_dfa(pattern, 64U));
+  }
+
+  rerex_free_pattern(pattern);
+
+  // Check that a DFA with too many states is scanned without the executor
+  assert(!rerex_compile_flags(
+    "(a|b)*a(a|b)(a|b)(a|b)(a|b)", REREX_FORCE_DFA, &end, &pattern));
+
+  size_t n_calls = 0U;
+  bool   match   = false;
+  memset(string, 'a', len);
+  assert(!rerex_match_chunked(
+    pattern, string, len, 4U, reverse_executor, &n_calls, &match));
+  assert(match && !n_calls);
+  rerex_free_pattern(pattern);
+
+  // Check a string that's rejected before matching because it's too short
+  assert(!rerex_compile("ab+", &end, &pattern));
+  check_chunked(pattern, "a", 1U);
+  rerex_free_pattern(pattern);
+}
+
+// Match with scratch memory, then again with a complete DFA
+static void
+check_scratch(const char* const regexp)
+{
+  RerexPattern* pattern = NULL;
+  size_t        end     = 0;
+
+  assert(!rerex_compile(regexp, &end, &pattern));
+
+  void* const scratch = malloc(rerex_matcher_size(pattern));
+
+  for (unsigned i = 0U; i < 2U; ++i) {
+    assert(rerex_match_scratch(pattern, scratch, "xxabbac", 7U));
+    assert(rerex_match_scratch(pattern, scratch, "c", 1U));
+    assert(!rerex_match_scratch(pattern, scratch, "xxabbac", 6U));
+    assert(!rerex_match_scratch(pattern, scratch, "cc", 2U));
+    assert(!rerex_compile_dfa(pattern, 4096U));
+  }
+
+  free(scratch);
+  rerex_free_pattern(pattern);
+}
+
+// Test matching with scratch memory instead of a matcher
+static void
+test_scratch(void)
+{
+  char long_regexp[1024];
+
+  check_scratch("x*(a|b)*c");
+  check_scratch(make_long_pattern(
+    long_regexp, sizeof(long_regexp), "x*(a|b)*c", "d?", 260U));
+}
+
+typedef struct {
+  RerexAllocator base;       ///< Allocator functions
+  size_t         n_live;     ///< Number of live allocations
+  size_t         n_attempts; ///< Number of allocation attempts
+  size_t         n_allowed;  ///< Number of attempts to allow before failing
+} TestAllocator;
+
+static void*
+test_malloc(RerexAllocator* const allocator, const size_t size)
+{
+  TestAllocator* const test = (TestAllocator*)allocator;
+  if (test->n_attempts++ >= test->n_allowed) {
+    return NULL;
+  }
+
+  ++test->n_live;
+  return malloc(size);
+}
+
+static void*
+test_calloc(RerexAllocator* const allocator,
+            const size_t          nmemb,
+            const size_t          size)
+{
+  void* const ptr = test_malloc(allocator, nmemb * size);
+  if (ptr) {
+    memset(ptr, 0, nmemb * size);
+  }
+
+  return ptr;
+}
+
+static void*
+test_realloc(RerexAllocator* const allocator,
+             void* const           ptr,
+             const size_t          size)
+{
+  TestAllocator* const test = (TestAllocator*)allocator;
+  if (test->n_attempts++ >= test->n_allowed) {
+    return NULL;
+  }
+
+  test->n_live += ptr ? 0U : 1U;
+  return realloc(ptr, size);
+}
+
+static void
+test_free(RerexAllocator* const allocator, void* const ptr)
+{
+  TestAllocator* const test = (TestAllocator*)allocator;
+
+  test->n_live -= ptr ? 1U : 0U;
+  free(ptr);
+}
+
+// Compile and match with an allocator that fails after `n_allowed` attempts
+static bool
+match_with_allocator(TestAllocator* const allocator)
+{
+  RerexPattern* pattern = NULL;
+  size_t        end     = 0;
+  bool          ok      = false;
+
+  if (!rerex_compile_alloc(
+        &allocator->base, "(ab|c)*[x-z]+d", 0U, &end, &pattern)) {
+    RerexMatcher* const matcher = rerex_new_matcher(pattern);
+    if (matcher) {
+      ok = !rerex_set_cache_size(matcher, 4096U) &&
+           rerex_match(matcher, "abcabzd") && !rerex_match(matcher, "abd") &&
+           !rerex_compile_dfa(pattern, 64U) &&
+           rerex_match(matcher, "abcabzd") && !rerex_match(matcher, "abd");
+
+      rerex_free_matcher(matcher);
+    }
+
+    // Match with a set of the pattern, which uses the same allocator
+    const RerexPattern* const members[] = {pattern};
+
+    RerexSet* const set = rerex_new_set_alloc(&allocator->base, members, 1U);
+
+    RerexMatcher* const set_matcher = set ? rerex_new_set_matcher(set) : NULL;
+
+    ok = ok && set_matcher &&
+         !rerex_set_match_first(set_matcher, "abcabzd", 7U) &&
+         rerex_set_match_first(set_matcher, "abd", 3U) == SIZE_MAX;
+
+    rerex_free_matcher(set_matcher);
+    rerex_free_set(set);
+    rerex_free_pattern(pattern);
+  }
+
+  assert(!allocator->n_live);
+  return ok;
+}
+
+// Test using a custom allocator, including when every allocation fails
+static void
+test_allocator(void)
+{
+  TestAllocator allocator = {
+    {test_malloc, test_calloc, test_realloc, test_free}, 0U, 0U, SIZE_MAX};
+
+  // Check that everything is allocated with the allocator and freed
+  assert(match_with_allocator(&allocator));
+  assert(allocator.n_attempts);
+
+  // Fail each allocation in turn, which must fail cleanly without leaks
+  const size_t n_attempts = allocator.n_attempts;
+  for (size_t i = 0U; i < n_attempts; ++i) {
+    allocator.n_attempts = 0U;
+    allocator.n_allowed  = i;
+    match_with_allocator(&allocator);
+  }
+
+  // Check the default allocator, which is used for a null allocator
+  RerexPattern* pattern = NULL;
+  size_t        end     = 0;
+
+  assert(!rerex_compile_alloc(NULL, "a", 0U, &end, &pattern));
+
+  RerexMatcher* const matcher = rerex_new_matcher_alloc(NULL, pattern);
+  assert(rerex_match(matcher, "a"));
+  rerex_free_matcher(matcher);
+  rerex_free_pattern(pattern);
+
+  RerexAllocator* const default_allocator = rerex_default_allocator();
+  void* ptr = default_allocator->malloc(default_allocator, 1U);
+
+  ptr = default_allocator->realloc(default_allocator, ptr, 2U);
+  default_allocator->free(default_allocator, ptr);
+}
+
+// Match a byte string with every engine, and return whether they all match
+static bool
+match_bytes(RerexPattern* const pattern,
+            const char* const   string,
+            const size_t        len,
+            const bool          should_match)
+{
+  RerexMatcher* const matcher = rerex_new_matcher(pattern);
+  bool                result  = rerex_match_n(matcher, string, len);
+
+  assert(!rerex_set_cache_size(matcher, 4096U));
+  result = result == should_match &&
+           rerex_match_n(matcher, string, len) == should_match &&
+           rerex_match_n(matcher, string, len) == should_match;
+
+  rerex_free_matcher(matcher);
+  return result;
+}
+
+// Test matching arbitrary bytes, including null, with REREX_BYTES
+static void
+test_bytes(void)
+{
+  static const char binary[] = {'a', '\0', '\xFF', 'z'};
+
+  RerexPattern* dots  = NULL;
+  RerexPattern* set   = NULL;
+  RerexPattern* ascii = NULL;
+  size_t        end   = 0;
+
+  const RerexFlags flags = REREX_BYTES | REREX_FORCE_BITS;
+
+  assert(!rerex_compile_flags("a..z", flags, &end, &dots));
+  assert(!rerex_compile_flags("a[^b-y]*z", flags, &end, &set));
+  assert(!rerex_compile_flags("a..z", REREX_FORCE_BITS, &end, &ascii));
+
+  assert(match_bytes(dots, binary, sizeof(binary), true));
+  assert(match_bytes(set, binary, sizeof(binary), true));
+  assert(match_bytes(ascii, binary, sizeof(binary), false));
+  assert(match_bytes(set, "a\0bz", 4U, false));
+  assert(match_bytes(set, "az", 2U, true));
+
+  assert(!rerex_compile_dfa(dots, 256U));
+  assert(!rerex_compile_dfa(set, 256U));
+  assert(!rerex_compile_dfa(ascii, 256U));
+
+  assert(match_bytes(dots, binary, sizeof(binary), true));
+  assert(match_bytes(set, binary, sizeof(binary), true));
+  assert(match_bytes(ascii, binary, sizeof(binary), false));
+
+  rerex_free_pattern(ascii);
+  rerex_free_pattern(set);
+  rerex_free_pattern(dots);
+}
+
+// Test a stream with a pattern, and saving and restoring it part way through
+static void
+check_stream(const char* const regexp, const char* const text)
+{
+  RerexPattern* pattern = NULL;
+  size_t        end     = 0;
+
+  assert(!rerex_compile(regexp, &end, &pattern));
+
+  RerexMatcher* const matcher = rerex_new_matcher(pattern);
+  RerexMatcher* const resumed = rerex_new_matcher(pattern);
+  const size_t        len     = strlen(text);
+  size_t              state[512];
+
+  // Check that the whole text matches, which abandons any stream
+  assert(rerex_match(matcher, text));
+  rerex_matcher_reset(matcher);
+
+  // Check progress through every prefix of text
+  assert(rerex_matcher_feed(matcher, text, 0U) == REREX_VIABLE);
+  for (size_t i = 0U; i + 1U < len; ++i) {
+    assert(rerex_matcher_feed(matcher, text + i, 1U) == REREX_VIABLE);
+  }
+
+  // Save the state before the last character, then finish
+  const size_t n_state = rerex_matcher_save(matcher, NULL, 0U);
+  assert(n_state > 0U && n_state <= 512U);
+  assert(rerex_matcher_save(matcher, state, 512U) == n_state);
+  assert(rerex_matcher_feed(matcher, text + len - 1U, 1U) == REREX_ACCEPTING);
+  assert(rerex_matcher_finish(matcher));
+
+  // Restore and finish with another matcher
+  assert(!rerex_matcher_restore(resumed, state, n_state));
+  assert(rerex_matcher_feed(resumed, text + len - 1U, 1U) == REREX_ACCEPTING);
+  assert(rerex_matcher_feed(resumed, "!", 1U) == REREX_DEAD);
+  assert(rerex_matcher_feed(resumed, text, len) == REREX_DEAD);
+  assert(!rerex_matcher_finish(resumed));
+
+  // Restore, then abandon the stream and start over
+  assert(!rerex_matcher_restore(resumed, state, n_state));
+  rerex_matcher_reset(resumed);
+  assert(rerex_matcher_feed(resumed, text, len) == REREX_ACCEPTING);
+  assert(rerex_matcher_finish(resumed));
+
+  // Try to restore an invalid state
+  state[0] = SIZE_MAX;
+  assert(rerex_matcher_restore(resumed, state, 1U) == REREX_BAD_STATE);
+  assert(rerex_matcher_feed(resumed, text, len) == REREX_ACCEPTING);
+
+  rerex_free_matcher(resumed);
+  rerex_free_matcher(matcher);
+  rerex_free_pattern(pattern);
+}
+
+// Test matching streams with every kind of simulation
+static void
+test_stream(void)
+{
+  char long_regexp[512];
+  char wide_regexp[512];
+
+  // Patterns with enough positions for multi-word sets, and too many for any
+  make_long_pattern(long_regexp, sizeof(long_regexp), "", "abcdefghij", 30U);
+  make_long_pattern(wide_regexp, sizeof(wide_regexp), "", "abcdefghij", 10U);
+
+  // Each matches itself, since it's a literal
+  check_stream("ab(c|d)*e", "abcdcde");
+  check_stream(wide_regexp, wide_regexp);
+  check_stream(long_regexp, long_regexp);
+}
+
+typedef struct {
+  const char* pattern;   ///< Regular expression
+  const char* text;      ///< Text to search
+  size_t      start;     ///< Start of the leftmost match, or SIZE_MAX
+  size_t      end;       ///< End of the leftmost-longest match
+  size_t      short_end; ///< End of the leftmost-shortest match
+} SearchTestCase;
+
+static const SearchTestCase search_tests[] = {
+  {"a", "a", 0U, 1U, 1U},
+  {"a", "xyz", SIZE_MAX, 0U, 0U},
+  {"b", "abc", 1U, 2U, 2U},
+  {"a*", "bbb", 0U, 0U, 0U},
+  {"a+", "baaab", 1U, 4U, 2U},
+  {"abcd|c", "abcd", 0U, 4U, 4U},
+  {"abcd|c", "abce", 2U, 3U, 3U},
+  {"(a|b)*c", "xababcabc", 1U, 6U, 6U},
+  {"(a|b|c)*c", "xababcabc", 1U, 9U, 6U},
+  {"[0-9]+(\\.[0-9]+)?", "pi is 3.14!", 6U, 10U, 7U},
+  {"ab|bcde", "abcde", 0U, 2U, 2U},
+  {"x", "", SIZE_MAX, 0U, 0U},
+  {"a?", "", 0U, 0U, 0U},
+};
+
+// Test searching for a match anywhere in a string
+static void
+test_search(void)
+{
+  const size_t n_tests = sizeof(search_tests) / sizeof(*search_tests);
+
+  for (size_t i = 0U; i < n_tests; ++i) {
+    const SearchTestCase* const test = &search_tests[i];
+    const size_t                len  = strlen(test->text);
+    const bool                  hit  = test->start != SIZE_MAX;
+
+    RerexPattern* pattern = NULL;
+    size_t        end     = 0;
+
+    assert(!rerex_compile(test->pattern, &end, &pattern));
+
+    RerexMatcher* const matcher = rerex_new_matcher(pattern);
+    size_t              s       = 0U;
+    size_t              e       = 0U;
+
+    assert(rerex_search(
+             matcher, test->text, len, REREX_LEFTMOST_LONGEST, NULL, NULL) ==
+           hit);
+
+    assert(rerex_search(
+             matcher, test->text, len, REREX_LEFTMOST_LONGEST, &s, &e) == hit);
+    assert(!hit || (s == test->start && e == test->end));
+
+    assert(rerex_search(
+             matcher, test->text, len, REREX_LEFTMOST_SHORTEST, &s, &e) ==
+           hit);
+    assert(!hit || (s == test->start && e == test->short_end));
+
+    // Get only one end of the match
+    s = e = SIZE_MAX;
+    assert(rerex_search(
+             matcher, test->text, len, REREX_LEFTMOST_LONGEST, &s, NULL) ==
+           hit);
+    assert(rerex_search(
+             matcher, test->text, len, REREX_LEFTMOST_LONGEST, NULL, &e) ==
+           hit);
+    assert(!hit || (s == test->start && e == test->end));
+
+    rerex_free_matcher(matcher);
+    rerex_free_pattern(pattern);
+  }
+}
+
+// Test finding every match in a string
+static void
+test_find_all(void)
+{
+  static const char* const text = "a1 b22 c333 d";
+
+  RerexPattern* pattern = NULL;
+  size_t        end     = 0;
+
+  assert(!rerex_compile("[0-9]*", &end, &pattern));
+
+  RerexMatcher* const matcher = rerex_new_matcher(pattern);
+  const size_t        len     = strlen(text);
+  size_t              offset  = 0U;
+  size_t              start   = 0U;
+  size_t              n_found = 0U;
+  size_t              n_empty = 0U;
+  char                digits[16];
+
+  while (rerex_find_next(
+    matcher, text, len, REREX_LEFTMOST_LONGEST, &offset, &start, &end)) {
+    assert(start <= end && end <= len);
+    if (start == end) {
+      ++n_empty;
+    } else {
+      memcpy(digits + n_found, text + start, end - start);
+      n_found += end - start;
+    }
+  }
+
+  // Every digit is found, along with an empty match at every other offset
+  assert(n_found == 6U);
+  assert(!memcmp(digits, "122333", 6U));
+  assert(n_empty == 8U);
+  assert(offset == len + 1U);
+  assert(!rerex_find_next(
+    matcher, text, len, REREX_LEFTMOST_LONGEST, &offset, &start, &end));
+
+  rerex_free_matcher(matcher);
+  rerex_free_pattern(pattern);
+}
+
+// Test that a set of patterns matches like every pattern individually
+static void
+check_set(const size_t first, const size_t n_patterns)
+{
+  RerexPattern* patterns[256] = {NULL};
+  RerexMatcher* matchers[256] = {NULL};
+  size_t        ids[256]      = {0U};
+
+  assert(n_patterns <= 256U);
+  for (size_t i = 0U; i < n_patterns; ++i) {
+    size_t end = 0;
+    assert(!rerex_compile(match_tests[first + i].pattern, &end, &patterns[i]));
+    matchers[i] = rerex_new_matcher(patterns[i]);
+  }
+
+  const RerexPattern* const* const members =
+    (const RerexPattern* const*)patterns;
+
+  RerexSet* const     set     = rerex_new_set(members, n_patterns);
+  RerexMatcher* const matcher = rerex_new_set_matcher(set);
+
+  // Check every test text against the set and every pattern in it
+  const size_t n_tests = sizeof(match_tests) / sizeof(*match_tests);
+  for (size_t t = 0U; t < n_tests; ++t) {
+    const char* const text    = match_tests[t].text;
+    const size_t      len     = strlen(text);
+    const size_t      n_found = rerex_set_match(matcher, text, len, ids);
+    size_t            n_seen  = 0U;
+
+    for (size_t i = 0U; i < n_patterns; ++i) {
+      if (rerex_match(matchers[i], text)) {
+        assert(n_seen < n_found && ids[n_seen] == i);
+        ++n_seen;
+      }
+    }
+
+    assert(n_seen == n_found);
+    assert(rerex_set_match_first(matcher, text, len) ==
+           (n_found ? ids[0] : SIZE_MAX));
+  }
+
+  rerex_free_matcher(matcher);
+  rerex_free_set(set);
+  for (size_t i = 0U; i < n_patterns; ++i) {
+    rerex_free_matcher(matchers[i]);
+    rerex_free_pattern(patterns[i]);
+  }
+}
+
+// Test matching sets of patterns with every kind of simulation
+static void
+test_set(void)
+{
+  const size_t n_tests = sizeof(match_tests) / sizeof(*match_tests);
+
+  check_set(0U, 0U);
+  check_set(0U, 8U);
+  check_set(n_tests - 24U, 24U);
+  check_set(n_tests - 100U, 100U);
+}
+
+// Check that a set matches every text like the patterns with the given IDs
+static void
+check_members(RerexMatcher* const        matcher,
+              RerexMatcher* const* const members,
+              const size_t               n_members)
+{
+  const size_t n_tests = sizeof(match_tests) / sizeof(*match_tests);
+  size_t       ids[64] = {0U};
+
+  for (size_t t = 0U; t < n_tests; ++t) {
+    const char* const text    = match_tests[t].text;
+    const size_t      len     = strlen(text);
+    const size_t      n_found = rerex_set_match(matcher, text, len, ids);
+    size_t            n_seen  = 0U;
+
+    for (size_t id = 0U; id < n_members; ++id) {
+      if (members[id] && rerex_match(members[id], text)) {
+        assert(n_seen < n_found && ids[n_seen] == id);
+        ++n_seen;
+      }
+    }
+
+    assert(n_seen == n_found);
+  }
+}
+
+// Test adding and removing patterns from a set
+static void
+test_set_update(void)
+{
+  const size_t  n_tests      = sizeof(match_tests) / sizeof(*match_tests);
+  RerexPattern* patterns[64] = {NULL};
+  RerexMatcher* members[64]  = {NULL};
+  size_t        end          = 0;
+  size_t        id           = 0U;
+
+  RerexSet* const     set     = rerex_new_set(NULL, 0U);
+  RerexMatcher* const matcher = rerex_new_set_matcher(set);
+
+  assert(!rerex_set_remove(set, 0U));
+  check_members(matcher, members, 0U);
+
+  // Add patterns one at a time, so the set and matcher grow
+  for (size_t i = 0U; i < 64U; ++i) {
+    const char* const regexp = match_tests[(i * 7U) % n_tests].pattern;
+    assert(!rerex_compile(regexp, &end, &patterns[i]));
+    assert(!rerex_set_add(set, patterns[i], &id));
+    assert(id == i);
+    members[i] = rerex_new_matcher(patterns[i]);
+  }
+
+  check_members(matcher, members, 64U);
+
+  // Remove every other pattern, which compacts the set at some point
+  for (size_t i = 0U; i < 64U; i += 2U) {
+    assert(rerex_set_remove(set, i));
+    assert(!rerex_set_remove(set, i));
+    rerex_free_matcher(members[i]);
+    members[i] = NULL;
+  }
+
+  check_members(matcher, members, 64U);
+
+  // Add them back, reusing the removed IDs
+  for (size_t i = 0U; i < 32U; ++i) {
+    assert(!rerex_set_add(set, patterns[i], &id));
+    assert(id % 2U == 0U && !members[id]);
+    members[id] = rerex_new_matcher(patterns[i]);
+  }
+
+  check_members(matcher, members, 64U);
+
+  // Remove everything, and check that nothing matches
+  for (size_t i = 0U; i < 64U; ++i) {
+    assert(rerex_set_remove(set, i));
+    rerex_free_matcher(members[i]);
+    members[i] = NULL;
+  }
+
+  assert(!rerex_set_remove(set, 64U));
+  check_members(matcher, members, 64U);
+
+  rerex_free_matcher(matcher);
+  rerex_free_set(set);
+  for (size_t i = 0U; i < 64U; ++i) {
+    rerex_free_pattern(patterns[i]);
+  }
+
+  // Reuse an ID for a pattern after others, then remove one to compact
+  static const char* const regexps[] = {
+    "aaaaa", "b", "xxxxxxxxxx", "dddddddddd"};
+
+  RerexSet* const reused = rerex_new_set(NULL, 0U);
+  for (size_t i = 0U; i < 4U; ++i) {
+    assert(!rerex_compile(regexps[i], &end, &patterns[i]));
+  }
+
+  assert(!rerex_set_add(reused, patterns[0], &id) && id == 0U);
+  assert(!rerex_set_add(reused, patterns[1], &id) && id == 1U);
+  assert(!rerex_set_add(reused, patterns[2], &id) && id == 2U);
+  assert(rerex_set_remove(reused, 0U));
+  assert(!rerex_set_add(reused, patterns[3], &id) && id == 0U);
+  assert(rerex_set_remove(reused, 2U));
+
+  RerexMatcher* const reused_matcher = rerex_new_set_matcher(reused);
+  assert(rerex_set_match_first(reused_matcher, "b", 1U) == 1U);
+  assert(rerex_set_match_first(reused_matcher, "dddddddddd", 10U) == 0U);
+  assert(rerex_set_match_first(reused_matcher, "dddd", 4U) == SIZE_MAX);
+  assert(rerex_set_match_first(reused_matcher, "aaaaa", 5U) == SIZE_MAX);
+  assert(rerex_set_match_first(reused_matcher, "xxxxxxxxxx", 10U) ==
+         SIZE_MAX);
+
+  rerex_free_matcher(reused_matcher);
+  rerex_free_set(reused);
+  for (size_t i = 0U; i < 4U; ++i) {
+    rerex_free_pattern(patterns[i]);
+  }
+}
+
+// Test that the literal prefix and suffix of patterns are found
+static void
+test_literals(void)
+{
+  const size_t n_tests = sizeof(literal_tests) / sizeof(*literal_tests);
+
+  for (size_t i = 0U; i < n_tests; ++i) {
+    RerexPattern* pattern = NULL;
+    size_t        end     = 0;
+
+    assert(!rerex_compile(literal_tests[i].pattern, &end, &pattern));
+    assert(!strcmp(rerex_prefix(pattern), literal_tests[i].prefix));
+    assert(!strcmp(rerex_suffix(pattern), literal_tests[i].suffix));
+
+    rerex_free_pattern(pattern);
+  }
+}
+
+// Test matching a long pattern with too many positions for bit-parallel sets
+static void
+test_long(void)
+{
+  char regexp[512];
+  char text[512];
+
+  make_long_pattern(regexp, sizeof(regexp), "", "abcdefghij", 30U);
+  make_long_pattern(text, sizeof(text), "", "abcdefghij", 30U);
+  regexp[300] = '+';
+  regexp[301] = '\0';
+
+  RerexPattern* pattern = NULL;
+  size_t        end     = 0;
+
+  assert(!rerex_compile(regexp, &end, &pattern));
+
+  RerexMatcher* const matcher = rerex_new_matcher(pattern);
+
+  assert(rerex_match(matcher, text));
+  assert(!rerex_match(matcher, text + 1));
+
+  text[299] = '*';
+  assert(!rerex_match(matcher, text));
+
+  rerex_free_matcher(matcher);
+  rerex_free_pattern(pattern);
+}
+
+// Test a pattern where closures pass through a long chain of split states
+static void
+test_closure(void)
+{
+  static const size_t n_optional = 1000U;
+
+  char* const regexp = (char*)calloc((2U * n_optional) + 2U, 1U);
+  char* const text   = (char*)calloc(n_optional + 2U, 1U);
+
+  for (size_t i = 0U; i < n_optional; ++i) {
+    regexp[2U * i]        = 'b';
+    regexp[(2U * i) + 1U] = '?';
+    text[i]               = 'b';
+  }
+
+  regexp[2U * n_optional] = 'c';
+  text[n_optional]        = 'c';
+
+  RerexPattern* pattern = NULL;
+  size_t        end     = 0;
+
+  assert(!rerex_compile(regexp, &end, &pattern));
+
+  RerexMatcher* const matcher = rerex_new_matcher(pattern);
+
+  assert(rerex_match(matcher, "c"));
+  assert(rerex_match(matcher, "bbc"));
+  assert(rerex_match(matcher, text));
+  assert(!rerex_match(matcher, "bbd"));
+
+  rerex_free_matcher(matcher);
+  rerex_free_pattern(pattern);
+  free(text);
+  free(regexp);
+}
+
+// Test patterns with deeply nested groups and many alternatives
+static void
+test_deep(void)
+{
+  static const size_t depth = 20000U;
+
+  char* const regexp = (char*)calloc((4U * depth) + 2U, 1U);
+
+  // Nest groups around a single character, then remove the last parenthesis
+  memset(regexp, '(', depth);
+  regexp[depth] = 'a';
+  memset(regexp + depth + 1U, ')', depth);
+
+  RerexPattern* pattern = NULL;
+  size_t        end     = 0;
+
+  assert(!rerex_compile(regexp, &end, &pattern));
+  assert(end == (2U * depth) + 1U);
+
+  RerexMatcher* matcher = rerex_new_matcher(pattern);
+
+  assert(rerex_match(matcher, "a"));
+  assert(!rerex_match(matcher, "b"));
+
+  rerex_free_matcher(matcher);
+  rerex_free_pattern(pattern);
+
+  regexp[2U * depth] = '\0';
+  assert(rerex_compile(regexp, &end, &pattern) == REREX_EXPECTED_RPAREN);
+  assert(end == 2U * depth);
+
+  // Alternate many two-character words, with the last word matching
+  for (size_t i = 0U; i < depth; ++i) {
+    regexp[3U * i]        = (char)('b' + (i % 16U));
+    regexp[(3U * i) + 1U] = 'a';
+    regexp[(3U * i) + 2U] = '|';
+  }
+
+  regexp[3U * depth]        = 'z';
+  regexp[(3U * depth) + 1U] = 'z';
+  regexp[(3U * depth) + 2U] = '\0';
+
+  assert(!rerex_compile_flags(regexp, REREX_EXACT_SIZE, &end, &pattern));
+  matcher = rerex_new_matcher(pattern);
+
+  assert(rerex_match(matcher, "ba"));
+  assert(rerex_match(matcher, "qa"));
+  assert(rerex_match(matcher, "zz"));
+  assert(!rerex_match(matcher, "ra"));
+  assert(!rerex_match(matcher, "b"));
+
+  rerex_free_matcher(matcher);
+  rerex_free_pattern(pattern);
+  free(regexp);
+}
+
+// Test that compiling a DFA fails cleanly when it has too many states
+static void
+test_dfa_limit(void)
+{
+  static const char* const regexp = "(a|b)*a(a|b)(a|b)(a|b)";
+
+  RerexPattern* pattern = NULL;
+  size_t        end     = 0;
+
+  assert(!rerex_compile(regexp, &end, &pattern));
+
+  RerexMatcher* const matcher = rerex_new_matcher(pattern);
+
+  // Fail to compile with too few states, which leaves the pattern unchanged
+  assert(rerex_compile_dfa(pattern, 0U) == REREX_TOO_MANY_STATES);
+  assert(rerex_compile_dfa(pattern, 1U) == REREX_TOO_MANY_STATES);
+  assert(rerex_compile_dfa(pattern, 16U) == REREX_TOO_MANY_STATES);
+  assert(rerex_match(matcher, "aaaa"));
+  assert(!rerex_match(matcher, "babb"));
+
+  // Compile with enough states (16 plus a dead state), then replace the DFA
+  assert(!rerex_compile_dfa(pattern, 17U));
+  assert(!rerex_compile_dfa(pattern, SIZE_MAX));
+  assert(rerex_match(matcher, "aaaa"));
+  assert(rerex_match(matcher, "babbb"));
+  assert(!rerex_match(matcher, "babb"));
+  assert(!rerex_match(matcher, "aaaac"));
+
+  rerex_free_matcher(matcher);
+  rerex_free_pattern(pattern);
+}
+
+typedef struct {
+  const char* pattern; ///< Regular expression
+  RerexEngine engine;  ///< Engine chosen automatically
+  const char* match;   ///< String that matches
+  const char* reject;  ///< String that doesn't match
+} EngineTestCase;
+
+// Test the automatic choice of engine, which must not affect the results
+static void
+test_engine(void)
+{
+  static const EngineTestCase tests[] = {
+    {"abc", REREX_ENGINE_LITERAL, "abc", "abd"},
+    {"(ab)(c)", REREX_ENGINE_LITERAL, "abc", "ab"},
+    {"a*b", REREX_ENGINE_DFA, "aab", "aba"},
+    {"(ab|c)*[x-z]+d", REREX_ENGINE_DFA, "abcxd", "abxcd"},
+    {"abcd[0-9]efgh", REREX_ENGINE_BITS, "abcd5efgh", "abcdxefgh"},
+    {"[0-9][0-9][0-9][0-9]-[0-9][0-9]-[0-9][0-9]T[0-9][0-9]:[0-9][0-9]",
+     REREX_ENGINE_DFA,
+     "2021-02-03T04:05",
+     "2021-02-03 04:05"},
+    {"(a|b)*a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)",
+     REREX_ENGINE_BITS,
+     "b" "a" "bbbbbbbbbb",
+     "b" "b" "aaaaaaaaaa"},
+    {"(a|b)*a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)"
+     "(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)"
+     "(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)z",
+     REREX_ENGINE_BITS,
+     "bb" "a" "bbbbbbbbbbbbbbbbbbbbbbbbbbbbbb" "z",
+     "bb" "b" "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaa" "z"},
+  };
+
+  for (size_t i = 0U; i < sizeof(tests) / sizeof(*tests); ++i) {
+    RerexPattern* pattern = NULL;
+    size_t        end     = 0;
+
+    assert(!rerex_compile(tests[i].pattern, &end, &pattern));
+    assert(rerex_engine(pattern) == tests[i].engine);
+    assert(rerex_engine_reason(pattern));
+
+    RerexMatcher* const matcher = rerex_new_matcher(pattern);
+    assert(rerex_match(matcher, tests[i].match));
+    assert(!rerex_match(matcher, tests[i].reject));
+    rerex_free_matcher(matcher);
+    rerex_free_pattern(pattern);
+  }
+
+  // Patterns with too many positions for bit sets are always simulated
+  char regexp[5U * 130U + 1U];
+  make_long_pattern(regexp, sizeof(regexp), "", "(a|b)", 130U);
+
+  RerexPattern* pattern = NULL;
+  size_t        end     = 0;
+
+  assert(!rerex_compile(regexp, &end, &pattern));
+  assert(rerex_engine(pattern) == REREX_ENGINE_NFA);
+
+  // Building a DFA explicitly switches to it
+  assert(!rerex_compile_dfa(pattern, 256U));
+  assert(rerex_engine(pattern) == REREX_ENGINE_DFA);
+  assert(!strcmp(rerex_engine_reason(pattern),
+                 "DFA built by rerex_compile_dfa()"));
+  rerex_free_pattern(pattern);
+
+  // Forcing an engine takes precedence, in order
+  const RerexFlags all = REREX_FORCE_NFA | REREX_FORCE_BITS | REREX_FORCE_DFA;
+  assert(!rerex_compile_flags("abc", all, &end, &pattern));
+  assert(rerex_engine(pattern) == REREX_ENGINE_NFA);
+  rerex_free_pattern(pattern);
+
+  assert(rerex_compile_flags(regexp, REREX_FORCE_BITS, &end, &pattern) ==
+         REREX_TOO_MANY_STATES);
+}
+
 int
 main(void)
 {
@@ -206,9 +1474,11 @@ main(void)
     const char* const text         = match_tests[i].text;
     const bool        should_match = match_tests[i].match;
 
+    // Compile for simulation, so the lazy DFA is used
     RerexPattern*     pattern = NULL;
     size_t            end     = 0;
-    const RerexStatus st      = rerex_compile(regexp, &end, &pattern);
+    const RerexStatus st =
+      rerex_compile_flags(regexp, REREX_FORCE_NFA, &end, &pattern);
 
     assert(!st);
 
@@ -217,9 +1487,81 @@ main(void)
 
     assert(matches == should_match);
 
+    // Match incrementally as a stream in two chunks, after abandoning it
+    const size_t len  = strlen(text);
+    const size_t half = len / 2U;
+    rerex_matcher_reset(matcher);
+    rerex_matcher_feed(matcher, text, half);
+    rerex_matcher_feed(matcher, text + half, len - half);
+    assert(rerex_matcher_finish(matcher) == should_match);
+
+    // Match twice with a lazy DFA, first building and then using the cache
+    assert(!rerex_set_cache_size(matcher, 4096U));
+    assert(rerex_match(matcher, text) == should_match);
+    assert(rerex_match(matcher, text) == should_match);
+
+    // Match with a complete DFA
+    assert(!rerex_compile_dfa(pattern, 256U));
+    assert(rerex_match(matcher, text) == should_match);
+
     rerex_free_matcher(matcher);
     rerex_free_pattern(pattern);
+
+    // Compile with an exact count of states (which is checked internally)
+    assert(!rerex_compile_flags(regexp, REREX_EXACT_SIZE, &end, &pattern));
+    RerexMatcher* const exact_matcher = rerex_new_matcher(pattern);
+    assert(rerex_match(exact_matcher, text) == should_match);
+    rerex_free_matcher(exact_matcher);
+    rerex_free_pattern(pattern);
+
+    // Compile with every engine, unless the pattern is too large for it
+    static const RerexFlags forced[] = {
+      0U, REREX_FORCE_NFA, REREX_FORCE_BITS, REREX_FORCE_DFA};
+
+    for (size_t f = 0U; f < sizeof(forced) / sizeof(*forced); ++f) {
+      const RerexStatus fst =
+        rerex_compile_flags(regexp, forced[f], &end, &pattern);
+      if (fst) {
+        assert(fst == REREX_TOO_MANY_STATES);
+        assert(forced[f] == REREX_FORCE_BITS || forced[f] == REREX_FORCE_DFA);
+        continue;
+      }
+
+      assert(rerex_engine_reason(pattern));
+      assert(forced[f] != REREX_FORCE_NFA ||
+             rerex_engine(pattern) == REREX_ENGINE_NFA);
+      assert(forced[f] != REREX_FORCE_BITS ||
+             rerex_engine(pattern) == REREX_ENGINE_BITS);
+      assert(forced[f] != REREX_FORCE_DFA ||
+             rerex_engine(pattern) == REREX_ENGINE_DFA);
+
+      RerexMatcher* const forced_matcher = rerex_new_matcher(pattern);
+      assert(rerex_match(forced_matcher, text) == should_match);
+      rerex_free_matcher(forced_matcher);
+      rerex_free_pattern(pattern);
+    }
   }
 
+  test_literals();
+  test_lengths();
+  test_match_n();
+  test_scratch();
+  test_allocator();
+  test_bytes();
+  test_batch();
+  test_parallel();
+  test_chunked();
+  test_stream();
+  test_search();
+  test_find_all();
+  test_set();
+  test_set_update();
+  test_cache();
+  test_cache_refill();
+  test_long();
+  test_closure();
+  test_deep();
+  test_dfa_limit();
+  test_engine();
   return 0;
 }
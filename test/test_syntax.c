@@ -56,7 +56,10 @@ test_status(void)
   assert(!strcmp(rerex_strerror(REREX_SUCCESS), "Success"));
   assert(!strcmp(rerex_strerror(REREX_NO_MEMORY), "Failed to allocate memory"));
 
-  assert(!strcmp(rerex_strerror((RerexStatus)((int)REREX_NO_MEMORY + 1)),
+  assert(!strcmp(rerex_strerror(REREX_TOO_MANY_STATES), "Too many DFA states"));
+  assert(!strcmp(rerex_strerror(REREX_BAD_STATE), "Invalid matcher state"));
+
+  assert(!strcmp(rerex_strerror((RerexStatus)((int)REREX_BAD_STATE + 1)),
                  "Unknown error"));
   assert(!strcmp(rerex_strerror((RerexStatus)INT32_MAX), "Unknown error"));
   assert(!strcmp(rerex_strerror((RerexStatus)UINT32_MAX), "Unknown error"));
@@ -80,6 +83,13 @@ test_syntax(void)
     assert(!pattern);
     assert(strcmp(rerex_strerror(st), rerex_strerror(REREX_SUCCESS)));
     assert(end == offset);
+
+    // Counting states first must not change how errors are reported
+    end = 0;
+    assert(rerex_compile_flags(regexp, REREX_EXACT_SIZE, &end, &pattern) ==
+           status);
+    assert(!pattern);
+    assert(end == offset);
   }
 }
 
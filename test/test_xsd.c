@@ -21,7 +21,23 @@
 #include "rerex/rerex.h"
 
 #include <assert.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <string.h>
+
+// Match a string as a stream, feeding it one character at a time
+static bool
+match_stream(RerexMatcher* const matcher, const char* const string)
+{
+  for (const char* s = string; *s; ++s) {
+    if (rerex_matcher_feed(matcher, s, 1U) == REREX_DEAD) {
+      rerex_matcher_reset(matcher);
+      return false;
+    }
+  }
+
+  return rerex_matcher_finish(matcher);
+}
 
 static void
 test_pattern(const char* const regexp,
@@ -44,8 +60,47 @@ test_pattern(const char* const regexp,
     assert(!rerex_match(matcher, *n));
   }
 
+  // Match everything incrementally as a stream
+  for (const char* const* m = matching; *m; ++m) {
+    assert(match_stream(matcher, *m));
+  }
+
+  for (const char* const* n = nonmatching; *n; ++n) {
+    assert(!match_stream(matcher, *n));
+  }
+
   rerex_free_matcher(matcher);
   rerex_free_pattern(pattern);
+
+  // Compile again for simulation, since a complete DFA is used by default
+  assert(!rerex_compile_flags(regexp, REREX_FORCE_NFA, &end, &pattern));
+  assert(rerex_engine(pattern) == REREX_ENGINE_NFA);
+
+  // Match everything twice with a lazy DFA to test cache hits
+  RerexMatcher* const lazy = rerex_new_matcher(pattern);
+  assert(!rerex_set_cache_size(lazy, 1U << 16U));
+  for (unsigned i = 0U; i < 2U; ++i) {
+    for (const char* const* m = matching; *m; ++m) {
+      assert(rerex_match(lazy, *m));
+    }
+
+    for (const char* const* n = nonmatching; *n; ++n) {
+      assert(!rerex_match(lazy, *n));
+    }
+  }
+
+  // Match everything with a complete DFA built explicitly
+  assert(!rerex_compile_dfa(pattern, 4096U));
+  for (const char* const* m = matching; *m; ++m) {
+    assert(rerex_match(lazy, *m));
+  }
+
+  for (const char* const* n = nonmatching; *n; ++n) {
+    assert(!rerex_match(lazy, *n));
+  }
+
+  rerex_free_matcher(lazy);
+  rerex_free_pattern(pattern);
 }
 
 static void